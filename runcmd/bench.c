@@ -0,0 +1,481 @@
+/*  bench.c - measures how fast libruncmd spawns and reaps, prints CSV
+
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include <runcmd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define BENCH_CMD "true"
+#define BENCH_SPAWNS 1000 /*spawns per row*/
+#define BENCH_RSS "10,100,1000,4096" /*parent RSS in MB*/
+#define BENCH_CONC "1,10,100,1000,10000" /*children running at the same time (nonblocking)*/
+#define BENCH_TORTURE 20000 /*children started by the torture mode*/
+#define BENCH_TORTURE_SECS 60 /*the torture mode gives up after this*/
+#define BENCH_MAXLIST 32
+
+static const char *backend_names[] = {"auto", "fork", "vfork", "clone", "posix", "forksrv"};
+
+/*spawn latencies in microseconds, filled by the done callback as the children are reaped*/
+static double *spawn_us;
+static volatile int ndone, nlost;
+
+/*reap latencies of blocking calls in microseconds, see run_row*/
+static double *reap_us;
+
+/*system calls libruncmd made, counted by the wrappers below*/
+static volatile unsigned long nsyscalls;
+
+#ifdef BENCH_SYSCALLS
+/*
+   with BENCH_WRAP (config.mk) the linker sends the calls libruncmd makes to 
+   these, each one is a system call (clock_gettime is in the vDSO, it isn't);
+   a clone or vfork child counts its sigprocmask too, it shares our memory
+ */
+#define BENCH_COUNT() ((void) __sync_fetch_and_add (&nsyscalls, 1))
+
+ssize_t __real_read (int fd, void *buf, size_t n);
+ssize_t __real_write (int fd, const void *buf, size_t n);
+ssize_t __real_pread (int fd, void *buf, size_t n, off_t off);
+int __real_close (int fd);
+int __real_pipe (int fds[2]);
+int __real_pipe2 (int fds[2], int flags);
+int __real_poll (struct pollfd *fds, nfds_t n, int timeout);
+ssize_t __real_splice (int in, void *off_in, int out, void *off_out, size_t len, unsigned int flags);
+pid_t __real_wait4 (pid_t pid, int *status, int options, struct rusage *ru);
+pid_t __real_waitpid (pid_t pid, int *status, int options);
+int __real_clone (int (*fn) (void *), void *stack, int flags, void *arg, ...);
+pid_t __real_vfork (void);
+pid_t __real_fork (void);
+int __real_sigprocmask (int how, const sigset_t *set, sigset_t *old);
+int __real_pthread_sigmask (int how, const sigset_t *set, sigset_t *old);
+int __real_memfd_create (const char *name, unsigned int flags);
+int __real_ftruncate (int fd, off_t len);
+void *__real_mmap (void *addr, size_t len, int prot, int flags, int fd, off_t off);
+int __real_munmap (void *addr, size_t len);
+int __real_kill (pid_t pid, int sig);
+long __real_syscall (long number, ...);
+int __real_fstat (int fd, struct stat *st);
+off_t __real_lseek (int fd, off_t off, int whence);
+int __real_fcntl (int fd, int cmd, ...);
+int __real_timer_settime (timer_t timer, int flags, const struct itimerspec *its, struct itimerspec *old);
+int __real_sigwaitinfo (const sigset_t *set, siginfo_t *info);
+int __real_sigtimedwait (const sigset_t *set, siginfo_t *info, const struct timespec *timeout);
+int __real_pthread_kill (unsigned long thread, int sig);
+ssize_t __real_sendmsg (int fd, const struct msghdr *msg, int flags);
+ssize_t __real_recvmsg (int fd, struct msghdr *msg, int flags);
+
+ssize_t __wrap_read (int fd, void *buf, size_t n) { BENCH_COUNT (); return __real_read (fd, buf, n); }
+ssize_t __wrap_write (int fd, const void *buf, size_t n) { BENCH_COUNT (); return __real_write (fd, buf, n); }
+ssize_t __wrap_pread (int fd, void *buf, size_t n, off_t off) { BENCH_COUNT (); return __real_pread (fd, buf, n, off); }
+int __wrap_close (int fd) { BENCH_COUNT (); return __real_close (fd); }
+int __wrap_pipe (int fds[2]) { BENCH_COUNT (); return __real_pipe (fds); }
+int __wrap_pipe2 (int fds[2], int flags) { BENCH_COUNT (); return __real_pipe2 (fds, flags); }
+int __wrap_poll (struct pollfd *fds, nfds_t n, int timeout) { BENCH_COUNT (); return __real_poll (fds, n, timeout); }
+ssize_t __wrap_splice (int in, void *off_in, int out, void *off_out, size_t len, unsigned int flags) {
+    BENCH_COUNT ();
+    return __real_splice (in, off_in, out, off_out, len, flags);
+}
+pid_t __wrap_wait4 (pid_t pid, int *status, int options, struct rusage *ru) { BENCH_COUNT (); return __real_wait4 (pid, status, options, ru); }
+pid_t __wrap_waitpid (pid_t pid, int *status, int options) { BENCH_COUNT (); return __real_waitpid (pid, status, options); }
+/*libruncmd passes no optional argument*/
+int __wrap_clone (int (*fn) (void *), void *stack, int flags, void *arg, ...) { BENCH_COUNT (); return __real_clone (fn, stack, flags, arg); }
+pid_t __wrap_vfork (void) { BENCH_COUNT (); return __real_vfork (); }
+pid_t __wrap_fork (void) { BENCH_COUNT (); return __real_fork (); }
+int __wrap_sigprocmask (int how, const sigset_t *set, sigset_t *old) { BENCH_COUNT (); return __real_sigprocmask (how, set, old); }
+int __wrap_pthread_sigmask (int how, const sigset_t *set, sigset_t *old) { BENCH_COUNT (); return __real_pthread_sigmask (how, set, old); }
+int __wrap_memfd_create (const char *name, unsigned int flags) { BENCH_COUNT (); return __real_memfd_create (name, flags); }
+int __wrap_ftruncate (int fd, off_t len) { BENCH_COUNT (); return __real_ftruncate (fd, len); }
+void *__wrap_mmap (void *addr, size_t len, int prot, int flags, int fd, off_t off) {
+    BENCH_COUNT ();
+    return __real_mmap (addr, len, prot, flags, fd, off);
+}
+int __wrap_munmap (void *addr, size_t len) { BENCH_COUNT (); return __real_munmap (addr, len); }
+int __wrap_kill (pid_t pid, int sig) { BENCH_COUNT (); return __real_kill (pid, sig); }
+int __wrap_fstat (int fd, struct stat *st) { BENCH_COUNT (); return __real_fstat (fd, st); }
+off_t __wrap_lseek (int fd, off_t off, int whence) { BENCH_COUNT (); return __real_lseek (fd, off, whence); }
+int __wrap_timer_settime (timer_t timer, int flags, const struct itimerspec *its, struct itimerspec *old) {
+    BENCH_COUNT ();
+    return __real_timer_settime (timer, flags, its, old);
+}
+int __wrap_sigwaitinfo (const sigset_t *set, siginfo_t *info) { BENCH_COUNT (); return __real_sigwaitinfo (set, info); }
+int __wrap_sigtimedwait (const sigset_t *set, siginfo_t *info, const struct timespec *timeout) {
+    BENCH_COUNT ();
+    return __real_sigtimedwait (set, info, timeout);
+}
+int __wrap_pthread_kill (unsigned long thread, int sig) { BENCH_COUNT (); return __real_pthread_kill (thread, sig); }
+ssize_t __wrap_sendmsg (int fd, const struct msghdr *msg, int flags) { BENCH_COUNT (); return __real_sendmsg (fd, msg, flags); }
+ssize_t __wrap_recvmsg (int fd, struct msghdr *msg, int flags) { BENCH_COUNT (); return __real_recvmsg (fd, msg, flags); }
+
+/*libruncmd passes at most 6 arguments, all of them fit in a long*/
+long __wrap_syscall (long number, ...) {
+    long a[6];
+    va_list ap;
+    int i;
+
+    va_start (ap, number);
+    for (i = 0; i < 6; ++i)
+        a[i] = va_arg (ap, long);
+    va_end (ap);
+    BENCH_COUNT ();
+    return __real_syscall (number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+/*fcntl takes an int or a pointer, passed on as a long*/
+int __wrap_fcntl (int fd, int cmd, ...) {
+    va_list ap;
+    long arg;
+
+    va_start (ap, cmd);
+    arg = va_arg (ap, long);
+    va_end (ap);
+    BENCH_COUNT ();
+    return __real_fcntl (fd, cmd, arg);
+}
+#endif
+
+static double now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double to_us (const struct timespec *ts) {
+    return ts->tv_sec * 1e6 + ts->tv_nsec / 1e3;
+}
+
+static int cmp_double (const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/*p-th percentile of the n sorted values*/
+static double percentile (double *v, int n, double p) {
+    int i = (int) (p * (n - 1) + 0.5);
+    return n > 0 ? v[i] : 0;
+}
+
+/*
+   p-th percentile of what the histogram before -> after counted, the upper
+   bound of its bucket (see RCMD_STATS_BUCKETS) in microseconds, 0 if empty
+ */
+static double hist_percentile (const unsigned long *before, const unsigned long *after, double p) {
+    unsigned long n = 0, seen = 0, target;
+    int i;
+
+    for (i = 0; i < RCMD_STATS_BUCKETS; ++i)
+        n += after[i] - before[i];
+    if (n == 0)
+        return 0;
+    target = (unsigned long) (p * (n - 1)) + 1;
+    for (i = 0; i < RCMD_STATS_BUCKETS - 1; ++i) {
+        seen += after[i] - before[i];
+        if (seen >= target)
+            break;
+    }
+    return (double) (1UL << i);
+}
+
+/*"10,100" -> {10, 100}, returns how many*/
+static int parse_list (const char *str, long *list) {
+    char *end;
+    int n = 0;
+
+    while (*str && n < BENCH_MAXLIST) {
+        list[n++] = strtol (str, &end, 10);
+        if (*end != ',')
+            break;
+        str = end + 1;
+    }
+    return n;
+}
+
+/*makes the parent hold mb megabytes of resident memory*/
+static char *grow_rss (char *mem, long mb) {
+    size_t i, size = (size_t) mb * 1024 * 1024;
+
+    free (mem);
+    mem = malloc (size ? size : 1);
+    if (mem == NULL) {
+        perror ("malloc");
+        exit (EXIT_FAILURE);
+    }
+    for (i = 0; i < size; i += 4096)
+        mem[i] = 1;
+    return mem;
+}
+
+static void done (pid_t pid, int result, void *user_data) {
+    const runcmd_info_t *info = runcmd_exit_info ();
+    int i = ndone;
+
+    if (pid < 0 || !IS_EXECOK (result) || info == NULL) {
+        ++nlost;
+        return ;
+    }
+    spawn_us[i] = to_us (&info->spawn_time);
+    ndone = i + 1;
+}
+
+/*
+   a CSV row of blocking runcmd_capture calls, which only give the result;
+   its point is the system calls per spawn of each io engine
+ */
+static void run_capture_row (const char *reaper, const char *backend, long rss, int spawns) {
+    unsigned long calls = nsyscalls;
+    runcmd_buf_t out;
+    double start, secs;
+    int i, result;
+
+    nlost = 0;
+    start = now ();
+    for (i = 0; i < spawns; ++i) {
+        runcmd_buf_init (&out, 0);
+        if (runcmd_capture (BENCH_CMD, &result, -1, &out, &out) < 0 || !IS_EXECOK (result))
+            ++nlost;
+        runcmd_buf_release (&out);
+    }
+    secs = now () - start;
+    calls = nsyscalls - calls;
+
+    printf ("capture,%s,%s,%ld,1,1,%d,%.3f,%.1f,0,0,0,0,%.1f,%d\n", reaper, backend, rss, spawns - nlost, secs,
+            (spawns - nlost) / secs, spawns > 0 ? (double) calls / spawns : 0, nlost);
+    fflush (stdout);
+}
+
+/*
+   one CSV row, nonblocking rows keep conc children running with a pool
+   their reap latency (from the SIGCHLD until the callback) comes from the
+   histogram of runcmd_stats; blocking calls wait for their own child and
+   don't count there, theirs is from the reaping (the end of run_time) 
+   until runcmd_exec returned
+ */
+static void run_row (runcmd_cmd_t *cmd, const char *reaper, const char *backend, long rss, int nonblock, long conc, int redirect, int spawns, int *io) {
+    runcmd_stats_t before, after;
+    runcmd_pool_t *pool = NULL;
+    unsigned long calls = nsyscalls;
+    runcmd_info_t info;
+    double start, secs, call;
+    int i;
+
+    ndone = nlost = 0;
+    runcmd_stats (&before);
+    start = now ();
+    if (nonblock) {
+        pool = runcmd_pool_new (conc);
+        for (i = 0; pool != NULL && i < spawns; ++i)
+            if (runcmd_pool_submit (pool, BENCH_CMD, redirect ? io : NULL, done, NULL) < 0)
+                ++nlost;
+        runcmd_pool_free (pool);
+    }
+    else {
+        for (i = 0; i < spawns; ++i) {
+            call = now ();
+            if (runcmd_exec (cmd, &info, redirect ? io : NULL, NULL) < 0 || !IS_EXECOK (info.result)) {
+                ++nlost;
+                continue;
+            }
+            /*the call started right before spawn_time, the child was reaped at the end of run_time*/
+            reap_us[ndone] = (now () - call) * 1e6 - to_us (&info.spawn_time) - to_us (&info.run_time);
+            spawn_us[ndone] = to_us (&info.spawn_time);
+            ++ndone;
+        }
+    }
+    secs = now () - start;
+    runcmd_stats (&after);
+    calls = nsyscalls - calls;
+
+    qsort (spawn_us, ndone, sizeof (double), cmp_double);
+    if (!nonblock)
+        qsort (reap_us, ndone, sizeof (double), cmp_double);
+    printf ("%s,%s,%s,%ld,%ld,%d,%d,%.3f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%d\n",
+            nonblock ? "nonblocking" : "blocking", reaper, backend, rss, conc, redirect, ndone, secs,
+            ndone / secs, percentile (spawn_us, ndone, 0.5), percentile (spawn_us, ndone, 0.99),
+            nonblock ? hist_percentile (before.reap_hist, after.reap_hist, 0.5) : percentile (reap_us, ndone, 0.5),
+            nonblock ? hist_percentile (before.reap_hist, after.reap_hist, 0.99) : percentile (reap_us, ndone, 0.99),
+            spawns > 0 ? (double) calls / spawns : 0, nlost);
+    fflush (stdout);
+}
+
+static volatile sig_atomic_t nexited, expired;
+
+static void count_exit (void) {
+    ++nexited;
+}
+
+static void torture_alarm (int sig) {
+    expired = 1;
+}
+
+/*
+   starts n nonblocking children at once so their SIGCHLDs get merged,
+   every one of them must still get its runcmd_onexit; it sleeps in 
+   sigsuspend until the last one (or SIGALRM after BENCH_TORTURE_SECS)
+ */
+static int torture (int n) {
+    struct sigaction act;
+    sigset_t chld, omask;
+    double start;
+    int i, started = 0;
+
+    memset (&act, 0, sizeof act);
+    act.sa_handler = torture_alarm;
+    sigemptyset (&act.sa_mask);
+    sigaction (SIGALRM, &act, NULL);
+    sigemptyset (&chld);
+    sigaddset (&chld, SIGCHLD);
+    sigaddset (&chld, SIGALRM);
+
+    runcmd_onexit = count_exit;
+    nexited = expired = 0;
+    start = now ();
+    alarm (BENCH_TORTURE_SECS);
+    for (i = 0; i < n; ++i)
+        if (runcmd (BENCH_CMD " &", NULL, NULL) >= 0)
+            ++started;
+
+    /*checked with SIGCHLD blocked, sigsuspend lets the handler run*/
+    sigprocmask (SIG_BLOCK, &chld, &omask);
+    while (nexited < started && !expired)
+        sigsuspend (&omask);
+    sigprocmask (SIG_SETMASK, &omask, NULL);
+    alarm (0);
+    runcmd_onexit = NULL;
+
+    printf ("torture,%d,%d,%d,%.3f\n", started, (int) nexited, started - (int) nexited, now () - start);
+    if (expired)
+        fprintf (stderr, "torture: %d children not reaped after %d seconds\n", started - (int) nexited, BENCH_TORTURE_SECS);
+    return started == n && nexited == started ? 0 : -1;
+}
+
+static void usage (const char *name) {
+    fprintf (stderr, "usage: %s [-e] [-u] [-n spawns] [-r rss_mb,...] [-c conc,...] [-b backend,...] [-t children]\n"
+            "defaults: -r " BENCH_RSS " -c " BENCH_CONC " (4 GB of memory and that many processes)\n"
+            "backends: 0 auto, 1 fork, 2 vfork, 3 clone, 4 posix, 5 fork server\n"
+            "-e reaps in event mode, which is always used with 4 and 5\n"
+            "-u captures with io_uring (the capture rows say uring if the kernel has it)\n"
+            "syscalls_per_spawn is 0 unless built with BENCH_WRAP (see config.mk)\n", name);
+    exit (EXIT_FAILURE);
+}
+
+int main (int argc, char **argv) {
+    long rss[BENCH_MAXLIST], conc[BENCH_MAXLIST], backends[BENCH_MAXLIST];
+    int nrss, nconc, nbackends, spawns = BENCH_SPAWNS, tort = 0, events = 0, uring = 0;
+    int opt, r, c, b, redirect, devnull, io[3];
+    const char *reaper, *capture_reaper;
+    runcmd_cmd_t *cmd;
+    char *mem = NULL;
+
+    nrss = parse_list (BENCH_RSS, rss);
+    nconc = parse_list (BENCH_CONC, conc);
+    backends[0] = RCMD_SPAWN_AUTO;
+    nbackends = 1;
+
+    while ((opt = getopt (argc, argv, "eun:r:c:b:t:")) != -1) {
+        switch (opt) {
+            case 'e': events = 1; break;
+            case 'u': uring = 1; break;
+            case 'n': spawns = atoi (optarg); break;
+            case 'r': nrss = parse_list (optarg, rss); break;
+            case 'c': nconc = parse_list (optarg, conc); break;
+            case 'b': nbackends = parse_list (optarg, backends); break;
+            case 't': tort = atoi (optarg) > 0 ? atoi (optarg) : BENCH_TORTURE; break;
+            default: usage (argv[0]);
+        }
+    }
+
+    if (tort) {
+        puts ("mode,started,exited,lost,seconds");
+        return torture (tort) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    for (c = 0; c < nconc; ++c)
+        if (conc[c] > spawns)
+            spawns = conc[c];
+    spawn_us = malloc (spawns * sizeof (double));
+    reap_us = malloc (spawns * sizeof (double));
+    cmd = runcmd_prepare (BENCH_CMD);
+    devnull = open ("/dev/null", O_RDWR);
+    if (spawn_us == NULL || reap_us == NULL || cmd == NULL || devnull < 0) {
+        perror ("bench");
+        return EXIT_FAILURE;
+    }
+    io[0] = io[1] = io[2] = devnull;
+
+    /*
+       pools start children from the reaper, posix_spawn and the fork server 
+       aren't async-signal-safe so they are only used from runcmd_dispatch
+     */
+    for (b = 0; b < nbackends; ++b)
+        if (backends[b] >= RCMD_SPAWN_POSIX)
+            events = 1;
+    if (events && runcmd_eventfd () < 0) {
+        perror ("runcmd_eventfd");
+        return EXIT_FAILURE;
+    }
+
+    reaper = events ? "event" : "signal";
+    capture_reaper = uring && runcmd_io_engine (RCMD_IO_URING) == RCMD_IO_URING ? "uring" : reaper;
+    puts ("mode,reaper,backend,rss_mb,concurrency,io,spawns,seconds,spawns_per_sec,"
+            "spawn_p50_us,spawn_p99_us,reap_p50_us,reap_p99_us,syscalls_per_spawn,lost");
+    for (b = 0; b < nbackends; ++b) {
+        if (backends[b] < RCMD_SPAWN_AUTO || backends[b] > RCMD_SPAWN_POSIX + 1)
+            usage (argv[0]);
+        /*the server is started while we are small, that's its point*/
+        if (backends[b] == RCMD_SPAWN_POSIX + 1) {
+            free (mem);
+            mem = NULL;
+            if (runcmd_forksrv_start () < 0)
+                continue;
+        }
+        else
+            runcmd_spawn_backend (backends[b]);
+
+        for (r = 0; r < nrss; ++r) {
+            mem = grow_rss (mem, rss[r]);
+            for (redirect = 0; redirect < 2; ++redirect) {
+                run_row (cmd, reaper, backend_names[backends[b]], rss[r], 0, 1, redirect, spawns, io);
+                for (c = 0; c < nconc; ++c)
+                    run_row (cmd, reaper, backend_names[backends[b]], rss[r], 1, conc[c], redirect, spawns, io);
+            }
+            /*the handler the pools installed would keep io_uring from reaping*/
+            runcmd_sigchld_restore ();
+            run_capture_row (capture_reaper, backend_names[backends[b]], rss[r], spawns);
+        }
+        runcmd_forksrv_stop ();
+    }
+
+    free (mem);
+    free (spawn_us);
+    free (reap_us);
+    runcmd_cmd_free (cmd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,482 @@
+/*  capture.c - runcmd_capture, keeps the output of a subprocess in memory
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#define _GNU_SOURCE /*splice and memfd_create*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <runcmd.h>
+#include "debug.h"
+#include "internal.h"
+
+#define RCMD_BUF_MIN 4096 /*first allocation of a buffer*/
+#define RCMD_SPLICE_MIN (1024 * 1024) /*output bigger than this goes to a file and is mapped*/
+#define RCMD_SPLICE_CHUNK (1024 * 1024) /*most bytes moved by one splice*/
+#define RCMD_CAPPED_SLACK (1024 * 1024) /*a nonblocking capture with a limit keeps at most limit + this*/
+
+void runcmd_buf_init (runcmd_buf_t *buf, size_t limit) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->limit = limit;
+    buf->truncated = 0;
+    buf->cap = 0;
+    buf->fd = -1;
+    buf->mapped = 0;
+}
+
+void runcmd_buf_release (runcmd_buf_t *buf) {
+    if (buf->mapped)
+        munmap (buf->data, buf->len + 1);
+    else
+        free (buf->data);
+    if (buf->fd >= 0)
+        close (buf->fd);
+    runcmd_buf_init (buf, buf->limit);
+}
+
+/*an unnamed file in memory, falls back to an unlinked file in /tmp*/
+static int rcmd_tmpfd (void) {
+    char name[] = "/tmp/runcmdXXXXXX";
+    int fd;
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+    fd = memfd_create ("runcmd", MFD_CLOEXEC);
+    if (fd >= 0)
+        return fd;
+#endif
+    fd = mkstemp (name);
+    sysfail (fd < 0, -1);
+    unlink (name);
+    fcntl (fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+/*
+   the file a nonblocking capture with a limit writes to, sealed so it can't
+   grow past limit + RCMD_CAPPED_SLACK bytes: a write that would is refused
+   whole (EPERM), the slack lets the ones that cross the limit in, so what is
+   past it tells the output was truncated; the file has that size from the
+   start, the offset the child shares with us says how much was written
+   limits need sealing, elsewhere (not Linux) they fail with EINVAL
+ */
+static int rcmd_capped_fd (size_t limit) {
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+    int fd = memfd_create ("runcmd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    sysfail (fd < 0, -1);
+    /*the pages are only allocated as they are written*/
+    if (ftruncate (fd, limit + RCMD_CAPPED_SLACK) < 0 || fcntl (fd, F_ADD_SEALS, F_SEAL_GROW) < 0) {
+        close (fd);
+        return -1;
+    }
+    return fd;
+#else
+    errno = EINVAL;
+    return -1;
+#endif
+}
+
+/*moves what was read so far into a file, the rest of the output is spliced after it*/
+static int rcmd_buf_to_file (runcmd_buf_t *buf) {
+    size_t off = 0;
+    ssize_t n;
+
+    buf->fd = rcmd_tmpfd ();
+    sysfail (buf->fd < 0, -1);
+    while (off < buf->len) {
+        n = write (buf->fd, buf->data + off, buf->len - off);
+        if (n < 0) {
+            close (buf->fd);
+            buf->fd = -1;
+            return -1;
+        }
+        off += n;
+    }
+    free (buf->data);
+    buf->data = NULL;
+    buf->cap = 0;
+    return 0;
+}
+
+/*
+   the first len bytes of buf->fd become buf->data, mapped if they are many
+   returns -1 in case of error
+ */
+static int rcmd_buf_map (runcmd_buf_t *buf, size_t size) {
+    void *ptr;
+    ssize_t n;
+
+    if (buf->len >= RCMD_SPLICE_MIN) {
+        /*one more byte so data is NUL terminated*/
+        if (size <= buf->len && ftruncate (buf->fd, buf->len + 1) < 0)
+            return -1;
+        ptr = mmap (NULL, buf->len + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, buf->fd, 0);
+        if (ptr != MAP_FAILED) {
+            buf->data = ptr;
+            buf->data[buf->len] = '\0';
+            buf->mapped = 1;
+            close (buf->fd);
+            buf->fd = -1;
+            return 0;
+        }
+    }
+
+    buf->data = malloc (buf->len + 1);
+    sysfail (buf->data == NULL, -1);
+    buf->cap = buf->len + 1;
+    n = pread (buf->fd, buf->data, buf->len, 0);
+    sysfail (n < 0, -1);
+    buf->len = n;
+    buf->data[buf->len] = '\0';
+    close (buf->fd);
+    buf->fd = -1;
+    return 0;
+}
+
+/*where the next bytes of a pipe go, see rcmd_buf_next*/
+#define RCMD_TO_DATA 0 /*the free space of buf->data*/
+#define RCMD_TO_FILE 1 /*spliced to buf->fd*/
+#define RCMD_TO_NOWHERE 2 /*past the limit, read into a scratch buffer*/
+
+/*
+   makes room for the next read into buf, returns where it goes (-1 in case of error),
+   *room gets how many bytes at most and *ptr the place for RCMD_TO_DATA
+ */
+static int rcmd_buf_next (runcmd_buf_t *buf, char **ptr, size_t *room) {
+    size_t ncap;
+    char *ndata;
+
+    if (buf->limit && buf->len >= buf->limit) {
+        /*keep draining so the child doesn't block on a full pipe*/
+        *room = RCMD_BUF_MIN;
+        return RCMD_TO_NOWHERE;
+    }
+    if (buf->fd >= 0) {
+        *room = (buf->limit && buf->limit - buf->len < RCMD_SPLICE_CHUNK) ? buf->limit - buf->len : RCMD_SPLICE_CHUNK;
+        return RCMD_TO_FILE;
+    }
+    if (buf->cap - buf->len < 2) {
+        ncap = buf->cap ? buf->cap * 2 : RCMD_BUF_MIN;
+        if (buf->limit && ncap > buf->limit + 1)
+            ncap = buf->limit + 1;
+        ndata = realloc (buf->data, ncap);
+        sysfail (ndata == NULL, -1);
+        buf->data = ndata;
+        buf->cap = ncap;
+        buf->data[buf->len] = '\0';
+    }
+    *ptr = buf->data + buf->len;
+    *room = buf->cap - buf->len - 1;
+    return RCMD_TO_DATA;
+}
+
+/*counts n bytes that went where rcmd_buf_next said, returns -1 in case of error*/
+static int rcmd_buf_got (runcmd_buf_t *buf, int to, size_t n) {
+    if (to == RCMD_TO_NOWHERE) {
+        buf->truncated = 1;
+        return 0;
+    }
+    buf->len += n;
+    if (to == RCMD_TO_DATA) {
+        buf->data[buf->len] = '\0';
+#ifdef __linux__
+        if (buf->len >= RCMD_SPLICE_MIN)
+            return rcmd_buf_to_file (buf);
+#endif
+    }
+    return 0;
+}
+
+/*
+   reads what is available in fd into buf, straight into its free space
+   returns 0 on end of file, 1 if there may be more later and -1 in case of error
+ */
+static int rcmd_buf_fill (runcmd_buf_t *buf, int fd) {
+    char scratch[RCMD_BUF_MIN], *ptr = NULL;
+    size_t room;
+    ssize_t n;
+    int to;
+
+    for (;;) {
+        to = rcmd_buf_next (buf, &ptr, &room);
+        sysfail (to < 0, -1);
+        if (to == RCMD_TO_FILE)
+            n = splice (fd, NULL, buf->fd, NULL, room, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        else
+            n = read (fd, to == RCMD_TO_DATA ? ptr : scratch, room);
+        if (n > 0 && rcmd_buf_got (buf, to, n) < 0)
+            return -1;
+
+        if (n == 0)
+            return 0;
+        if (n < 0)
+            return (errno == EAGAIN || errno == EINTR) ? 1 : -1;
+    }
+}
+
+/*the buffers once their pipes are closed, output that went to a file is mapped*/
+static int rcmd_capture_end (runcmd_buf_t **bufs, int n) {
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        if (bufs[i]->fd >= 0)
+            sysfail (rcmd_buf_map (bufs[i], bufs[i]->len) < 0, -1);
+        else if (bufs[i]->data == NULL) {
+            bufs[i]->data = calloc (1, 1);
+            bufs[i]->cap = 1;
+        }
+    }
+    return 0;
+}
+
+/*reads both pipes until the child closes them*/
+static int rcmd_capture_loop (int *pipefd, runcmd_buf_t **bufs, int n) {
+    struct pollfd pfd[2];
+    int i, aux, open = n;
+
+    for (i = 0; i < n; ++i) {
+        pfd[i].fd = pipefd[i];
+        pfd[i].events = POLLIN;
+    }
+
+    while (open > 0) {
+        aux = poll (pfd, n, -1);
+        if (aux < 0 && errno == EINTR)
+            continue;
+        sysfail (aux < 0, -1);
+
+        for (i = 0; i < n; ++i) {
+            if (pfd[i].fd < 0 || !pfd[i].revents)
+                continue;
+            aux = rcmd_buf_fill (bufs[i], pfd[i].fd);
+            sysfail (aux < 0, -1);
+            if (aux == 0) {
+                pfd[i].fd = -1;
+                --open;
+            }
+        }
+    }
+    return rcmd_capture_end (bufs, n);
+}
+
+/*
+   queues the next read of pipe i, to[i] gets where it goes; after an error (*aux < 0)
+   the rest is thrown away, the child mustn't block on a full pipe
+   returns 1 if it was queued
+ */
+static int rcmd_ring_fill (rcmd_ring_t *ring, int *pipefd, runcmd_buf_t **bufs, int i, int *to, char (*scratch)[RCMD_BUF_MIN], int *aux) {
+    char *ptr = NULL;
+    size_t room = RCMD_BUF_MIN;
+
+    if (*aux == 0 && (to[i] = rcmd_buf_next (bufs[i], &ptr, &room)) < 0)
+        *aux = -1;
+    if (*aux < 0) {
+        to[i] = RCMD_TO_NOWHERE;
+        room = RCMD_BUF_MIN;
+    }
+    if (to[i] == RCMD_TO_FILE)
+        return rcmd_ring_splice (ring, pipefd[i], bufs[i]->fd, room, i) == 0;
+    return rcmd_ring_read (ring, pipefd[i], to[i] == RCMD_TO_DATA ? ptr : scratch[i], room, i) == 0;
+}
+
+/*
+   rcmd_capture_loop with io_uring, the reads of both pipes are submitted together
+   with the waitid of the child if si isn't NULL (its tag is n), then each one is 
+   queued again as it completes; *reaped is 1 if waitid reaped the child
+ */
+static int rcmd_capture_ring (rcmd_ring_t *ring, int *pipefd, runcmd_buf_t **bufs, int n, pid_t pid, siginfo_t *si, int *reaped) {
+    char scratch[2][RCMD_BUF_MIN];
+    int i, res, to[2], open = 0, waiting = 0, aux = 0;
+    long tag;
+
+    *reaped = 0;
+    if (si != NULL && rcmd_ring_waitid (ring, pid, si, n) == 0)
+        waiting = 1;
+    for (i = 0; i < n; ++i)
+        open += rcmd_ring_fill (ring, pipefd, bufs, i, to, scratch, &aux);
+
+    /*every request must complete, they write into our buffers*/
+    while (open > 0 || waiting) {
+        if (rcmd_ring_next (ring, &tag, &res) < 0)
+            return -1;
+        if (tag == n) {
+            waiting = 0;
+            *reaped = res == 0;
+            continue;
+        }
+        i = tag;
+        --open;
+        if (res == 0) /*end of file*/
+            continue;
+        if (res < 0 && res != -EINTR && res != -EAGAIN) {
+            errno = -res;
+            aux = -1;
+            continue;
+        }
+        if (res > 0 && aux == 0 && rcmd_buf_got (bufs[i], to[i], res) < 0)
+            aux = -1;
+        open += rcmd_ring_fill (ring, pipefd, bufs, i, to, scratch, &aux);
+    }
+    sysfail (aux < 0, -1);
+    return rcmd_capture_end (bufs, n);
+}
+
+int runcmd_capture (const char *command, int *result, int input, runcmd_buf_t *out, runcmd_buf_t *err) {
+    int i, n = 0, aux = 0, tmp_result, pending, reaped = 0, errnum;
+    int io[3] = {-1, -1, -1}, pipefd[2][2], rdfd[2];
+    runcmd_buf_t *bufs[2];
+    char *cmd, *args[RCMD_MAXARGS];
+    sigset_t omask, cmask;
+    rcmd_ring_t *ring;
+    runcmd_info_t info;
+    rcmd_proc_t proc;
+    siginfo_t si;
+    pid_t pid;
+
+    tmp_result = rcmd_nonblock (command) ? NONBLOCK : 0;
+    io[0] = input;
+    /*with io_uring the pipes block, the ring waits for them*/
+    ring = IS_NONBLOCK (tmp_result) ? NULL : rcmd_ring_get ();
+
+    /*out and err may be the same buffer, then both go to the same pipe (or file)*/
+    if (out)
+        bufs[n++] = out;
+    if (err && err != out)
+        bufs[n++] = err;
+
+    for (i = 0; i < n; ++i) {
+        if (IS_NONBLOCK (tmp_result)) {
+            /*nobody reads while the child runs, so it writes to a file*/
+            bufs[i]->fd = bufs[i]->limit ? rcmd_capped_fd (bufs[i]->limit) : rcmd_tmpfd ();
+            aux = bufs[i]->fd < 0 ? -1 : 0;
+            pipefd[i][1] = bufs[i]->fd;
+        }
+        else {
+            aux = rcmd_pipe (pipefd[i], ring == NULL);
+            rdfd[i] = pipefd[i][0];
+        }
+        if (aux < 0) {
+            n = i;
+            goto close_pipes;
+        }
+    }
+    if (out)
+        io[1] = pipefd[0][1];
+    if (err)
+        io[2] = pipefd[err == out ? 0 : n-1][1];
+
+    aux = rcmd_split (command, &cmd, args);
+    if (aux < 0)
+        goto close_pipes;
+
+    rcmd_block (&omask, &cmask);
+
+    /*other threads use the registry (and spawn) while this one spawns, as in rcmd_run*/
+    pid = proc.pid = -1;
+    if (rcmd_unlock_pending () == 0) {
+        pid = rcmd_start (NULL, args, io, &cmask, NULL, &proc);
+        rcmd_lock_pending ();
+    }
+    free (cmd);
+
+    if (pid < 0)
+        aux = -1;
+    else if (IS_NONBLOCK (tmp_result)) {
+        aux = register_child_callback (&proc);
+        if (aux < 0) {
+            /*nobody would reap it and the caller doesn't get its pid, as in runcmd_stream_add*/
+            errnum = errno;
+            kill (pid, SIGKILL);
+            while (waitpid (pid, NULL, 0) < 0 && errno == EINTR)
+                ;
+            errno = errnum;
+        }
+    }
+    else {
+        /*our copies of the write ends must be closed to see the end of file*/
+        for (i = 0; i < n; ++i)
+            close (pipefd[i][1]);
+        /*other threads use the registry while the output is read*/
+        pending = rcmd_unlock_pending () == 0;
+        /*if nobody else reaps, the ring does it with the same system calls that read*/
+        if (ring != NULL)
+            aux = rcmd_capture_ring (ring, rdfd, bufs, n, pid, rcmd_forksrv_req < 0 && rcmd_direct_wait () ? &si : NULL, &reaped);
+        else
+            aux = rcmd_capture_loop (rdfd, bufs, n);
+        if (pending)
+            rcmd_lock_pending ();
+        if (reaped)
+            rcmd_child_reaped (&proc, rcmd_ring_status (&si), &info);
+        if (!reaped && rcmd_wait_child (&proc, &info, &omask) < 0)
+            aux = -1;
+        else
+            tmp_result |= info.result;
+        for (i = 0; i < n; ++i)
+            close (rdfd[i]);
+        n = 0;
+    }
+    rcmd_unblock (&omask);
+
+close_pipes:
+    if (ring != NULL)
+        rcmd_ring_put (ring);
+    for (i = 0; i < n; ++i) {
+        if (!IS_NONBLOCK (tmp_result)) {
+            close (pipefd[i][0]);
+            close (pipefd[i][1]);
+        }
+        else if (aux < 0) {
+            close (bufs[i]->fd);
+            bufs[i]->fd = -1;
+        }
+    }
+    sysfail (aux < 0, -1);
+
+    if (result)
+        *result = tmp_result;
+    return pid;
+}
+
+int runcmd_capture_collect (runcmd_buf_t *buf) {
+    struct stat st;
+
+    sysfail (buf->fd < 0, -1);
+    sysfail (fstat (buf->fd, &st) < 0, -1);
+
+    buf->len = st.st_size;
+    /*a capped file has its whole size from the start, see rcmd_capped_fd*/
+    if (buf->limit) {
+        off_t off = lseek (buf->fd, 0, SEEK_CUR);
+        sysfail (off < 0, -1);
+        buf->len = off;
+    }
+    if (buf->limit && buf->len > buf->limit) {
+        buf->len = buf->limit;
+        buf->truncated = 1;
+    }
+    return rcmd_buf_map (buf, st.st_size);
+}
@@ -21,14 +21,25 @@ PREFIX = ./local
 CC = gcc
 CPP_FLAGS = -Wall --ansi --pedantic-errors -D_POSIX_C_SOURCE=200809L
 C_FLAGS =
-LD_FLAGS =
+LD_FLAGS = -pthread
 MAKE = make
 AR = ar
 TAR = tar 
 
 bin =
 lib = libruncmd
-libruncmd_obj = runcmd.o
-libruncmd_h = runcmd.h
+libruncmd_obj = runcmd.o capture.o stream.o forksrv.o pool.o prepare.o stats.o pipeline.o uring.o
+libruncmd_h = runcmd.h runcmd.hpp
 
-EXTRA_DIST = runcmd.txt Makefile config.mk
+EXTRA_DIST = runcmd.txt Makefile config.mk bench.c
+
+#see make benchmark
+BENCH_FLAGS =
+BENCH_TORTURE = 20000
+
+#the bench counts the system calls of libruncmd by wrapping them (GNU ld), empty to not count
+BENCH_WRAP = -Wl,--wrap=read,--wrap=write,--wrap=pread,--wrap=close,--wrap=pipe,--wrap=pipe2,--wrap=poll,--wrap=splice \
+	-Wl,--wrap=wait4,--wrap=waitpid,--wrap=clone,--wrap=vfork,--wrap=fork,--wrap=sigprocmask,--wrap=pthread_sigmask \
+	-Wl,--wrap=memfd_create,--wrap=ftruncate,--wrap=mmap,--wrap=munmap,--wrap=kill,--wrap=syscall,--wrap=fstat \
+	-Wl,--wrap=lseek,--wrap=fcntl,--wrap=timer_settime,--wrap=sigwaitinfo,--wrap=sigtimedwait,--wrap=pthread_kill \
+	-Wl,--wrap=sendmsg,--wrap=recvmsg
@@ -0,0 +1,408 @@
+/*  forksrv.c - fork server, a small helper process that spawns for runcmd
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#define _GNU_SOURCE /*MSG_NOSIGNAL and SOCK_CLOEXEC*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <runcmd.h>
+#include "debug.h"
+#include "internal.h"
+
+/*
+   the parent writes a request (with the io fds attached) in rcmd_forksrv_req and
+   reads the reply from it, exits are sent as datagrams in rcmd_forksrv_exit
+ */
+int rcmd_forksrv_req = -1, rcmd_forksrv_exit = -1;
+pid_t rcmd_forksrv_pid = -1;
+
+/*threads spawn without the registry, each request and its reply go together*/
+pthread_mutex_t rcmd_forksrv_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    int argc;
+    size_t len; /*bytes of the strings that follow (path, argv, cwd, then env), each one NUL terminated*/
+    int has_path; /*0 to search argv[0] in PATH*/
+    int redir[3]; /*1 if a fd for io[i] is attached*/
+    sigset_t mask;
+    int has_attr;
+    runcmd_attr_t attr; /*only what the child itself uses, env and cwd travel as strings*/
+    int has_cwd, nenv;
+} rcmd_srvreq_t;
+
+typedef struct {
+    pid_t pid; /*-1 if the child couldn't be created*/
+    int err; /*errno of the spawn if pid is -1, otherwise errno of exec*/
+} rcmd_srvrep_t;
+
+typedef struct {
+    pid_t pid;
+    int status;
+    struct rusage ru;
+} rcmd_srvexit_t;
+
+/*reads exactly len bytes, returns -1 on error or end of file*/
+static int rcmd_read_all (int fd, void *buf, size_t len) {
+    ssize_t n;
+    while (len > 0) {
+        n = read (fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf = (char *)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int rcmd_write_all (int fd, const void *buf, size_t len) {
+    ssize_t n;
+    while (len > 0) {
+        n = send (fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        buf = (const char *)buf + n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+   the helper
+ */
+
+int rcmd_srv_pipe[2]; /*SIGCHLD of the helper, written by the handler*/
+
+static void rcmd_srv_sigchld (int sig) {
+    int err = errno;
+    write (rcmd_srv_pipe[1], "", 1);
+    errno = err;
+}
+
+/*serves one request, returns -1 if the parent has gone*/
+static int rcmd_srv_spawn (int req) {
+    char ctl[CMSG_SPACE ((3 + RCMD_PASS_MAX) * sizeof (int))], *data, **argv, **env, *path = NULL;
+    int i, nfd = 0, fds[3 + RCMD_PASS_MAX], io[3] = {-1, -1, -1};
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    rcmd_srvreq_t hdr;
+    rcmd_srvrep_t rep;
+    ssize_t n;
+
+    memset (&msg, 0, sizeof msg);
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof hdr;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl;
+    msg.msg_controllen = sizeof ctl;
+
+    do
+        n = recvmsg (req, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+    if (n != sizeof hdr)
+        return -1;
+
+    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL; cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            nfd = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+            if (nfd > 3 + RCMD_PASS_MAX)
+                nfd = 3 + RCMD_PASS_MAX;
+            memcpy (fds, CMSG_DATA (cmsg), nfd * sizeof (int));
+        }
+    }
+    for (i = 0, n = 0; i < 3; ++i)
+        if (hdr.redir[i] && n < nfd)
+            io[i] = fds[n++];
+    /*the passed fds come after the io ones, in order*/
+    if (hdr.has_attr)
+        for (i = 0; i < hdr.attr.npass; ++i)
+            hdr.attr.pass[i].fd = n < nfd ? fds[n++] : -1;
+
+    data = malloc (hdr.len + 1);
+    argv = malloc ((hdr.argc + 1) * sizeof (char *));
+    env = malloc ((hdr.nenv + 1) * sizeof (char *));
+    if (data == NULL || argv == NULL || env == NULL || rcmd_read_all (req, data, hdr.len) < 0) {
+        free (data);
+        free (argv);
+        free (env);
+        return -1;
+    }
+    n = 0;
+    if (hdr.has_path) {
+        path = data;
+        n = strlen (path) + 1;
+    }
+    for (i = 0; i < hdr.argc; ++i) {
+        argv[i] = data + n;
+        n += strlen (data + n) + 1;
+    }
+    argv[i] = NULL;
+    if (hdr.has_cwd) {
+        hdr.attr.cwd = data + n;
+        n += strlen (data + n) + 1;
+    }
+    for (i = 0; i < hdr.nenv; ++i) {
+        env[i] = data + n;
+        n += strlen (data + n) + 1;
+    }
+    env[i] = NULL;
+    if (hdr.nenv > 0)
+        hdr.attr.env = (const char *const *) env;
+
+    rep.err = 0;
+    rep.pid = rcmd_spawn (path, argv, io, &hdr.mask, hdr.has_attr ? &hdr.attr : NULL, &rep.err);
+    if (rep.pid < 0)
+        rep.err = errno;
+
+    for (i = 0; i < nfd; ++i)
+        close (fds[i]);
+    free (data);
+    free (argv);
+    free (env);
+    return rcmd_write_all (req, &rep, sizeof rep);
+}
+
+static void rcmd_srv_main (int req, int exitfd, pid_t parent) {
+    struct pollfd pfd[2];
+    struct sigaction act;
+    rcmd_srvexit_t ex;
+    sigset_t chld;
+    char buf[64];
+
+    sysfatal (pipe (rcmd_srv_pipe) < 0);
+    fcntl (rcmd_srv_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl (rcmd_srv_pipe[1], F_SETFL, O_NONBLOCK);
+    fcntl (rcmd_srv_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl (rcmd_srv_pipe[1], F_SETFD, FD_CLOEXEC);
+
+    memset (&act, 0, sizeof act);
+    act.sa_handler = rcmd_srv_sigchld;
+    act.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset (&act.sa_mask);
+    sigaction (SIGCHLD, &act, NULL);
+    sigemptyset (&chld);
+    sigaddset (&chld, SIGCHLD);
+    sigprocmask (SIG_UNBLOCK, &chld, NULL);
+
+    pfd[0].fd = req;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = rcmd_srv_pipe[0];
+    pfd[1].events = POLLIN;
+
+    for (;;) {
+        if (poll (pfd, 2, -1) < 0) {
+            sysfatal (errno != EINTR);
+            continue;
+        }
+
+        if (pfd[1].revents) {
+            int sent = 0;
+            while (read (rcmd_srv_pipe[0], buf, sizeof buf) > 0)
+                ;
+            while ((ex.pid = wait4 (-1, &ex.status, WNOHANG, &ex.ru)) > 0) {
+                if (send (exitfd, &ex, sizeof ex, MSG_NOSIGNAL) < 0)
+                    _exit (EXIT_FAILURE);
+                sent = 1;
+            }
+            /*the parent reaps them as it would reap its own children*/
+            if (sent)
+                kill (parent, SIGCHLD);
+        }
+
+        /*the parent closed the socket (runcmd_forksrv_stop) or died*/
+        if (pfd[0].revents && rcmd_srv_spawn (req) < 0)
+            _exit (EXIT_SUCCESS);
+    }
+}
+
+/*
+   the parent
+ */
+
+int runcmd_forksrv_start (void) {
+    int req[2], exitfd[2];
+    pid_t parent = getpid ();
+
+    if (rcmd_forksrv_req >= 0)
+        return 0;
+
+    sysfail (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, req) < 0, -1);
+    if (socketpair (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, exitfd) < 0) {
+        close (req[0]);
+        close (req[1]);
+        return -1;
+    }
+
+    /*the helper is small only if this is called early, so a plain fork is fine*/
+    rcmd_forksrv_pid = fork ();
+    if (rcmd_forksrv_pid == 0) {
+        close (req[0]);
+        close (exitfd[0]);
+        rcmd_srv_main (req[1], exitfd[1], parent);
+    }
+    close (req[1]);
+    close (exitfd[1]);
+    if (rcmd_forksrv_pid < 0) {
+        close (req[0]);
+        close (exitfd[0]);
+        return -1;
+    }
+
+    fcntl (exitfd[0], F_SETFL, O_NONBLOCK);
+    rcmd_forksrv_req = req[0];
+    rcmd_forksrv_exit = exitfd[0];
+    return 0;
+}
+
+void runcmd_forksrv_stop (void) {
+    if (rcmd_forksrv_pid < 0)
+        return ;
+    if (rcmd_forksrv_req >= 0)
+        close (rcmd_forksrv_req);
+    close (rcmd_forksrv_exit);
+    rcmd_forksrv_req = rcmd_forksrv_exit = -1;
+    /*the handler may have taken it already*/
+    waitpid (rcmd_forksrv_pid, NULL, 0);
+    rcmd_forksrv_pid = -1;
+}
+
+pid_t rcmd_forksrv_spawn (const char *path, char *const argv[], const int *io, const sigset_t *mask, const runcmd_attr_t *attr, int *exec_err) {
+    char ctl[CMSG_SPACE ((3 + RCMD_PASS_MAX) * sizeof (int))], *data;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    rcmd_srvreq_t hdr;
+    rcmd_srvrep_t rep;
+    int i, nfd = 0, fds[3 + RCMD_PASS_MAX];
+    size_t off = 0;
+
+    memset (&hdr, 0, sizeof hdr);
+    for (hdr.argc = 0; argv[hdr.argc] != NULL; ++hdr.argc)
+        hdr.len += strlen (argv[hdr.argc]) + 1;
+    if (path != NULL) {
+        hdr.has_path = 1;
+        hdr.len += strlen (path) + 1;
+    }
+    hdr.mask = *mask;
+    if (attr != NULL) {
+        hdr.has_attr = 1;
+        hdr.attr = *attr;
+        hdr.attr.cwd = NULL;
+        hdr.attr.env = NULL;
+        if (attr->cwd != NULL) {
+            hdr.has_cwd = 1;
+            hdr.len += strlen (attr->cwd) + 1;
+        }
+        for (hdr.nenv = 0; attr->env && attr->env[hdr.nenv] != NULL; ++hdr.nenv)
+            hdr.len += strlen (attr->env[hdr.nenv]) + 1;
+    }
+    for (i = 0; io && i < 3; ++i) {
+        if (io[i] > 0) {
+            hdr.redir[i] = 1;
+            fds[nfd++] = io[i];
+        }
+    }
+    if (attr != NULL) {
+        if (hdr.attr.npass > RCMD_PASS_MAX)
+            hdr.attr.npass = RCMD_PASS_MAX;
+        for (i = 0; i < hdr.attr.npass; ++i)
+            fds[nfd++] = attr->pass[i].fd;
+    }
+
+    data = malloc (hdr.len);
+    sysfail (data == NULL, -1);
+    if (path != NULL) {
+        strcpy (data, path);
+        off = strlen (path) + 1;
+    }
+    for (i = 0; i < hdr.argc; ++i) {
+        strcpy (data + off, argv[i]);
+        off += strlen (argv[i]) + 1;
+    }
+    if (hdr.has_cwd) {
+        strcpy (data + off, attr->cwd);
+        off += strlen (attr->cwd) + 1;
+    }
+    for (i = 0; i < hdr.nenv; ++i) {
+        strcpy (data + off, attr->env[i]);
+        off += strlen (attr->env[i]) + 1;
+    }
+
+    memset (&msg, 0, sizeof msg);
+    iov.iov_base = &hdr;
+    iov.iov_len = sizeof hdr;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfd > 0) {
+        msg.msg_control = ctl;
+        msg.msg_controllen = CMSG_SPACE (nfd * sizeof (int));
+        cmsg = CMSG_FIRSTHDR (&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN (nfd * sizeof (int));
+        memcpy (CMSG_DATA (cmsg), fds, nfd * sizeof (int));
+    }
+
+    pthread_mutex_lock (&rcmd_forksrv_lock);
+    if (rcmd_forksrv_req < 0
+            || sendmsg (rcmd_forksrv_req, &msg, MSG_NOSIGNAL) != sizeof hdr
+            || rcmd_write_all (rcmd_forksrv_req, data, hdr.len) < 0
+            || rcmd_read_all (rcmd_forksrv_req, &rep, sizeof rep) < 0) {
+        free (data);
+        /*the server is broken, from now on runcmd spawns by itself*/
+        if (rcmd_forksrv_req >= 0)
+            close (rcmd_forksrv_req);
+        rcmd_forksrv_req = -1;
+        pthread_mutex_unlock (&rcmd_forksrv_lock);
+        return -1;
+    }
+    pthread_mutex_unlock (&rcmd_forksrv_lock);
+    free (data);
+
+    if (rep.pid < 0) {
+        errno = rep.err;
+        return -1;
+    }
+    *exec_err = rep.err;
+    return rep.pid;
+}
+
+int rcmd_forksrv_reap (void) {
+    rcmd_srvexit_t ex;
+    int count = 0;
+
+    while (recv (rcmd_forksrv_exit, &ex, sizeof ex, MSG_DONTWAIT) == sizeof ex)
+        count += rcmd_child_exited (ex.pid, ex.status, &ex.ru);
+    return count;
+}
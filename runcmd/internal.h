@@ -0,0 +1,192 @@
+/*  internal.h - functions shared by the sources of libruncmd (not installed)
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#ifndef RCMD_INTERNAL_H
+#define RCMD_INTERNAL_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <runcmd.h>
+
+/*a child just created by rcmd_start*/
+typedef struct {
+    pid_t pid;
+    int exec_err; /*errno of exec in the child, 0 if it succeeded*/
+    struct timespec start, exec; /*before spawning and once exec was done*/
+    const runcmd_attr_t *attr; /*may be NULL, only valid during the call*/
+} rcmd_proc_t;
+
+/*returns 1 if command has to run in nonblocking mode (its last word starts with '&')*/
+int rcmd_nonblock (const char *command);
+
+/*
+   splits command into words, args points into buf, which the caller must free
+   returns the number of words (a last word starting with '&' is not included)
+ */
+int rcmd_split (const char *command, char **buf, char *args[]);
+
+/*
+   blocks SIGCHLD and takes the registry of children (shared by all the threads),
+   *omask gets the mask to restore afterwards and *cmask the one the child must have
+ */
+void rcmd_block (sigset_t *omask, sigset_t *cmask);
+
+/*releases the registry and restores omask, after rcmd_block*/
+void rcmd_unblock (const sigset_t *omask);
+
+/*
+   releases the registry while this thread spawns a child (or does something else
+   slow) before registering it, a reaper in another thread keeps the child for 
+   rcmd_register or rcmd_wait_child, SIGCHLD stays blocked; -1 in case of error
+ */
+int rcmd_unlock_pending (void);
+
+/*takes the registry back after rcmd_unlock_pending*/
+void rcmd_lock_pending (void);
+
+/*
+   creates a subprocess running argv with attr (may be NULL), the subprocess gets
+   the signal mask in *mask, path is the executable or NULL to search argv[0] in PATH
+   returns the pid of the child or -1 if it couldn't be created,
+   *exec_err is 0 if exec succeeded, otherwise the errno of exec in the child
+ */
+pid_t rcmd_spawn (const char *path, char *const argv[], const int *io, const sigset_t *mask, const runcmd_attr_t *attr, int *exec_err);
+
+/*rcmd_spawn that also takes the times of the child, returns proc->pid*/
+pid_t rcmd_start (const char *path, char *const argv[], const int *io, const sigset_t *mask, const runcmd_attr_t *attr, rcmd_proc_t *proc);
+
+/*
+   runs argv (path as in rcmd_spawn) and waits for it unless nonblock,
+   everything runcmd_ex does after parsing, returns the pid or -1
+   a nonblocking child calls done (if not NULL) instead of runcmd_onexit
+ */
+int rcmd_run (const char *path, char *const argv[], int nonblock, runcmd_info_t *info, const int *io, const runcmd_attr_t *attr,
+        runcmd_done_t done, void *user_data);
+
+/*registers a nonblocking child with the current runcmd_onexit, SIGCHLD must be blocked*/
+int register_child_callback (const rcmd_proc_t *proc);
+
+/*
+   registers a nonblocking child, exited (if not NULL) is called with its 
+   information and ptr instead of runcmd_onexit, SIGCHLD must be blocked
+ */
+int rcmd_register (const rcmd_proc_t *proc, void (*exited) (const runcmd_info_t *, void *), void *ptr);
+
+/*rcmd_register with a runcmd_done_t*/
+int rcmd_register_done (const rcmd_proc_t *proc, runcmd_done_t done, void *user_data);
+
+/*
+   arms the timeout of attr (if it has one) once for the process group pgid, 
+   counting from start, instead of once per child: the members still registered
+   get TIMEDOUT if it expires, and it is disarmed when the last one is reaped
+   SIGCHLD must be blocked, returns -1 in case of error
+ */
+int rcmd_group_timeout (pid_t pgid, const runcmd_info_t *members, int n, const struct timespec *start, const runcmd_attr_t *attr);
+
+/*
+   frees ptr, or keeps it until the registry is released outside the SIGCHLD
+   handler if called from it (ptr must have room for a pointer), SIGCHLD must be blocked
+ */
+void rcmd_free (void *ptr);
+
+/*
+   makes room for n more children, so registering them from the SIGCHLD handler
+   doesn't allocate memory, SIGCHLD must be blocked
+ */
+int rcmd_reserve (size_t n);
+
+/*
+   sleeps until some child finished and was reaped (or some other signal arrived),
+   the registry is released meanwhile
+   SIGCHLD must be blocked and omask is the mask to restore
+ */
+int rcmd_wait_event (const sigset_t *omask);
+
+/*
+   waits for a blocking child and fills *info, SIGCHLD must be blocked and omask
+   is the mask to restore, returns -1 in case of error
+ */
+int rcmd_wait_child (const rcmd_proc_t *proc, runcmd_info_t *info, const sigset_t *omask);
+
+/*1 if nobody else reaps a blocking child without a timeout, so it may be waited for directly*/
+int rcmd_direct_wait (void);
+
+/*fills *info for a blocking child its caller reaped with the wait status (no rusage)*/
+void rcmd_child_reaped (const rcmd_proc_t *proc, int status, runcmd_info_t *info);
+
+/*
+   called for each child that finished (ru may be NULL), runs its callback (or wakes 
+   up the blocking runcmd waiting for it), SIGCHLD must be blocked
+   returns 1 if pid was started by runcmd, 0 otherwise
+ */
+int rcmd_child_exited (pid_t pid, int status, const struct rusage *ru);
+
+/*fork server (forksrv.c), the fds are -1 if it isn't running*/
+extern int rcmd_forksrv_req, rcmd_forksrv_exit;
+
+/*rcmd_spawn through the fork server, if it fails rcmd_forksrv_req becomes -1*/
+pid_t rcmd_forksrv_spawn (const char *path, char *const argv[], const int *io, const sigset_t *mask, const runcmd_attr_t *attr, int *exec_err);
+
+/*calls rcmd_child_exited for the children the server reported, returns how many*/
+int rcmd_forksrv_reap (void);
+
+/*statistics (stats.c), all async-signal-safe*/
+void rcmd_stats_spawn (const rcmd_proc_t *proc);
+void rcmd_stats_outstanding (int n);
+
+/*latency is from the start of the reaping, NULL if it wasn't reaped by the handler*/
+void rcmd_stats_exit (const runcmd_info_t *info, const struct timespec *latency);
+
+/*pipe with both ends close on exec, the read end doesn't block if nonblock*/
+int rcmd_pipe (int pipefd[2], int nonblock);
+
+/*
+   io_uring (uring.c), the rings are kept in a free list and each one is used by one
+   thread at a time; rcmd_ring_get returns NULL unless the engine is RCMD_IO_URING
+   (none of this is async-signal-safe)
+ */
+typedef struct rcmd_ring_t rcmd_ring_t;
+
+rcmd_ring_t *rcmd_ring_get (void);
+void rcmd_ring_put (rcmd_ring_t *ring);
+
+/*
+   queue a request, submitted by the next rcmd_ring_next, tag comes back with its
+   completion; the buffers must be there until then, returns -1 if the ring is full
+   (or doesn't do waitid, which reaps pid with WEXITED and fills *si)
+ */
+int rcmd_ring_read (rcmd_ring_t *ring, int fd, void *buf, size_t len, long tag);
+int rcmd_ring_splice (rcmd_ring_t *ring, int fd_in, int fd_out, size_t len, long tag);
+int rcmd_ring_waitid (rcmd_ring_t *ring, pid_t pid, siginfo_t *si, long tag);
+
+/*
+   the next completion, *res is what the syscall would return or -errno; what was
+   queued is submitted in the same io_uring_enter that waits, returns -1 in case of error
+ */
+int rcmd_ring_next (rcmd_ring_t *ring, long *tag, int *res);
+
+/*the wait status waitid put in *si*/
+int rcmd_ring_status (const siginfo_t *si);
+
+/*the runcmd result bits (without NONBLOCK) for a wait status*/
+int rcmd_result (int status, int exec_err);
+
+#endif
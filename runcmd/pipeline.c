@@ -0,0 +1,200 @@
+/*  pipeline.c - runcmd_pipeline, runs commands connected by pipes
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#include <runcmd.h>
+#include "debug.h"
+#include "internal.h"
+
+/*
+   a running pipeline, its stages are registered as nonblocking children
+   so each one is reaped as soon as it finishes
+ */
+typedef struct rcmd_pline_t {
+    int n;
+    volatile int remaining; /*stages not reaped yet*/
+    int notify; /*call done once remaining is 0*/
+    runcmd_pipeline_done_t done;
+    void *user_data;
+    runcmd_info_t infos[1]; /*n of them*/
+} rcmd_pline_t;
+
+/*called by the reaper for each stage*/
+static void rcmd_stage_exited (const runcmd_info_t *info, void *ptr) {
+    rcmd_pline_t *pl = ptr;
+    int i;
+
+    for (i = 0; i < pl->n; ++i)
+        if (pl->infos[i].pid == info->pid)
+            pl->infos[i] = *info;
+    if (--pl->remaining > 0 || !pl->notify)
+        return ;
+    if (pl->done)
+        pl->done (pl->infos, pl->n, pl->user_data);
+    /*inside the handler it is freed once the registry is released elsewhere*/
+    rcmd_free (pl);
+}
+
+/*a stage that had to be started again in a new group, only reaped*/
+static void rcmd_stage_dropped (const runcmd_info_t *info, void *ptr) {
+    (void) info;
+    (void) ptr;
+}
+
+pid_t runcmd_pipeline (const char *const *const stages[], int n, int nonblock, runcmd_info_t *infos, const int *io,
+        const runcmd_attr_t *attr, runcmd_pipeline_done_t done, void *user_data) {
+    int aux = 0, started, pipefd[2], in, sio[3];
+    runcmd_attr_t sattr;
+    sigset_t omask, cmask;
+    struct timespec start;
+    rcmd_pline_t *pl;
+    rcmd_proc_t proc;
+    pid_t pgid = 0;
+
+    if (n <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    pl = malloc (sizeof (rcmd_pline_t) + (n - 1) * sizeof (runcmd_info_t));
+    sysfail (pl==NULL, -1);
+    memset (pl, 0, sizeof (rcmd_pline_t) + (n - 1) * sizeof (runcmd_info_t));
+    pl->n = n;
+    pl->done = done;
+    pl->user_data = user_data;
+
+    /*every stage goes to the group of the first one*/
+    if (attr)
+        sattr = *attr;
+    else
+        runcmd_attr_init (&sattr);
+    sattr.pgroup = 1;
+    sattr.pgid = 0;
+    /*armed once for the group when every stage is running, see rcmd_group_timeout*/
+    sattr.timeout = 0;
+
+    rcmd_block (&omask, &cmask);
+
+    in = io ? io[0] : -1;
+    sio[2] = io ? io[2] : -1;
+    for (started = 0; started < n; ++started) {
+        sio[0] = in;
+        if (started == n - 1) {
+            pipefd[0] = pipefd[1] = -1;
+            sio[1] = io ? io[1] : -1;
+        }
+        else {
+            /*the next stage reads it, so it must block*/
+            if (rcmd_pipe (pipefd, 0) < 0) {
+                if (started > 0)
+                    close (in);
+                break;
+            }
+            sio[1] = pipefd[1];
+        }
+
+        for (;;) {
+            /*other threads use the registry (and spawn) while this one spawns, as in rcmd_run*/
+            proc.pid = -1;
+            if (rcmd_unlock_pending () == 0) {
+                rcmd_start (NULL, (char *const *) stages[started], sio, &cmask, &sattr, &proc);
+                /*the child joins the group itself too, whichever is first (as job control shells do)*/
+                if (proc.pid > 0)
+                    setpgid (proc.pid, pgid > 0 ? pgid : proc.pid);
+                rcmd_lock_pending ();
+            }
+            if (proc.pid < 0 || proc.exec_err != EPERM || pgid == 0 || kill (-pgid, 0) == 0 || errno != ESRCH)
+                break;
+            /*
+               the group is gone: every stage in it has finished and was reaped (by the
+               reaper thread, another thread or the fork server) before this one could
+               join, so this one starts a new group for the rest of the pipeline
+             */
+            if (rcmd_register (&proc, rcmd_stage_dropped, NULL) < 0)
+                waitpid (proc.pid, NULL, 0);
+            pgid = sattr.pgid = 0;
+        }
+        if (proc.pid >= 0) {
+            pl->infos[started].pid = proc.pid;
+            pl->infos[started].result = NONBLOCK;
+            pl->remaining++;
+            /*another thread may have reaped it already, then rcmd_stage_exited runs here*/
+            if (rcmd_register (&proc, rcmd_stage_exited, pl) < 0) {
+                kill (proc.pid, SIGKILL);
+                pl->remaining--;
+                proc.pid = -1;
+            }
+        }
+
+        /*our copies of the pipe ends the stages use*/
+        if (started > 0)
+            close (in);
+        if (pipefd[1] >= 0)
+            close (pipefd[1]);
+        in = pipefd[0];
+
+        if (proc.pid < 0) {
+            if (in >= 0)
+                close (in);
+            break;
+        }
+        if (started == 0)
+            start = proc.start;
+        if (pgid == 0)
+            pgid = sattr.pgid = proc.pid;
+    }
+
+    if (started == n && attr && rcmd_group_timeout (pgid, pl->infos, n, &start, attr) < 0)
+        started = -1;
+    if (started < n) {
+        /*the stages that were started can't do anything useful*/
+        aux = -1;
+        if (pgid > 0)
+            kill (-pgid, SIGKILL);
+        nonblock = 0;
+    }
+
+    if (nonblock) {
+        if (infos)
+            memcpy (infos, pl->infos, n * sizeof (runcmd_info_t));
+        /*the last stage may be over already*/
+        pl->notify = 1;
+        if (pl->remaining == 0)
+            rcmd_stage_exited (&pl->infos[n-1], pl);
+    }
+    else {
+        while (pl->remaining > 0 && rcmd_wait_event (&omask) == 0)
+            ;
+        if (pl->remaining > 0)
+            aux = -1;
+        if (aux == 0 && infos)
+            memcpy (infos, pl->infos, n * sizeof (runcmd_info_t));
+        /*a stage still registered keeps its pointer to pl*/
+        if (pl->remaining == 0)
+            free (pl);
+    }
+    rcmd_unblock (&omask);
+    sysfail (aux < 0, -1);
+    return pgid;
+}
@@ -0,0 +1,217 @@
+/*  pool.c - runcmd_pool, runs many commands with at most N at a time
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <signal.h>
+#include <errno.h>
+#include <runcmd.h>
+#include "debug.h"
+#include "internal.h"
+
+/*
+   a submitted command, its words are split at submit time so starting it
+   from the SIGCHLD handler only has to spawn
+ */
+typedef struct rcmd_job_t {
+    char *buf; /*the words of the command*/
+    char **argv; /*points into buf*/
+    int io[3];
+    runcmd_done_t done;
+    void *user_data;
+    runcmd_pool_t *pool;
+    struct rcmd_job_t *next;
+} rcmd_job_t;
+
+/*
+   the queue and the finished list are changed by the SIGCHLD handler,
+   so SIGCHLD is blocked while they are changed elsewhere
+ */
+struct runcmd_pool_t {
+    int max; /*most children running at the same time*/
+    int running;
+    rcmd_job_t *head, *tail; /*jobs waiting for a free slot*/
+    rcmd_job_t *finished; /*jobs to be freed outside the handler*/
+    sigset_t cmask; /*signal mask of the children*/
+};
+
+static void rcmd_job_free (rcmd_job_t *job) {
+    free (job->buf);
+    free (job->argv);
+    free (job);
+}
+
+/*frees the jobs that have finished, SIGCHLD must be blocked*/
+static void rcmd_pool_gc (runcmd_pool_t *pool) {
+    rcmd_job_t *job, *aux;
+
+    for (job = pool->finished; job != NULL; job = aux) {
+        aux = job->next;
+        rcmd_job_free (job);
+    }
+    pool->finished = NULL;
+}
+
+static void rcmd_pool_exited (const runcmd_info_t *info, void *ptr);
+
+/*
+   starts queued jobs while there are free slots, it may run inside the SIGCHLD
+   handler so it only spawns (memory was reserved by runcmd_pool_new)
+   SIGCHLD must be blocked
+ */
+static void rcmd_pool_start (runcmd_pool_t *pool) {
+    rcmd_proc_t proc;
+    rcmd_job_t *job;
+
+    while (pool->running < pool->max && pool->head != NULL) {
+        job = pool->head;
+        pool->head = job->next;
+        if (pool->head == NULL)
+            pool->tail = NULL;
+
+        if (rcmd_start (NULL, job->argv, job->io, &pool->cmask, NULL, &proc) >= 0
+                && rcmd_register (&proc, rcmd_pool_exited, job) == 0) {
+            ++pool->running;
+            continue;
+        }
+
+        /*it couldn't be started, the caller still hears about it*/
+        if (job->done)
+            job->done (-1, 0, job->user_data);
+        job->next = pool->finished;
+        pool->finished = job;
+    }
+}
+
+/*called by the reaper when a child of the pool finishes, its slot goes to the next job*/
+static void rcmd_pool_exited (const runcmd_info_t *info, void *ptr) {
+    rcmd_job_t *job = ptr;
+    runcmd_pool_t *pool = job->pool;
+
+    --pool->running;
+    rcmd_pool_start (pool);
+
+    if (job->done)
+        job->done (info->pid, info->result, job->user_data);
+    job->next = pool->finished;
+    pool->finished = job;
+}
+
+runcmd_pool_t *runcmd_pool_new (int max) {
+    runcmd_pool_t *pool;
+    sigset_t omask, cmask;
+    int aux;
+
+    if (max <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    pool = calloc (1, sizeof (runcmd_pool_t));
+    sysfail (pool==NULL, NULL);
+    pool->max = max;
+
+    rcmd_block (&omask, &cmask);
+    aux = rcmd_reserve (max);
+    rcmd_unblock (&omask);
+    if (aux < 0) {
+        free (pool);
+        return NULL;
+    }
+    return pool;
+}
+
+int runcmd_pool_submit (runcmd_pool_t *pool, const char *command, const int *io, runcmd_done_t done, void *user_data) {
+    char *args[RCMD_MAXARGS];
+    sigset_t omask, cmask;
+    rcmd_job_t *job;
+    int i, argc;
+
+    job = malloc (sizeof (rcmd_job_t));
+    sysfail (job==NULL, -1);
+    argc = rcmd_split (command, &job->buf, args);
+    if (argc < 0) {
+        free (job);
+        return -1;
+    }
+    job->argv = malloc ((argc + 1) * sizeof (char *));
+    if (job->argv == NULL) {
+        free (job->buf);
+        free (job);
+        return -1;
+    }
+    memcpy (job->argv, args, (argc + 1) * sizeof (char *));
+    for (i = 0; i < 3; ++i)
+        job->io[i] = io ? io[i] : -1;
+    job->done = done;
+    job->user_data = user_data;
+    job->pool = pool;
+    job->next = NULL;
+
+    rcmd_block (&omask, &cmask);
+    pool->cmask = cmask;
+    rcmd_pool_gc (pool);
+    if (pool->tail)
+        pool->tail->next = job;
+    else
+        pool->head = job;
+    pool->tail = job;
+    rcmd_pool_start (pool);
+    rcmd_unblock (&omask);
+    return 0;
+}
+
+int runcmd_pool_pending (runcmd_pool_t *pool) {
+    sigset_t omask, cmask;
+    rcmd_job_t *job;
+    int count;
+
+    rcmd_block (&omask, &cmask);
+    count = pool->running;
+    for (job = pool->head; job != NULL; job = job->next)
+        ++count;
+    rcmd_unblock (&omask);
+    return count;
+}
+
+int runcmd_pool_wait (runcmd_pool_t *pool) {
+    sigset_t omask, cmask;
+    int aux = 0;
+
+    rcmd_block (&omask, &cmask);
+    while (aux == 0 && (pool->running > 0 || pool->head != NULL))
+        aux = rcmd_wait_event (&omask);
+    rcmd_pool_gc (pool);
+    rcmd_unblock (&omask);
+    return aux;
+}
+
+void runcmd_pool_free (runcmd_pool_t *pool) {
+    rcmd_job_t *job, *aux;
+
+    if (pool == NULL)
+        return ;
+    runcmd_pool_wait (pool);
+    /*only if waiting failed*/
+    for (job = pool->head; job != NULL; job = aux) {
+        aux = job->next;
+        rcmd_job_free (job);
+    }
+    free (pool);
+}
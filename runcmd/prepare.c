@@ -0,0 +1,124 @@
+/*  prepare.c - runcmd_prepare, commands parsed once and executed many times
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <runcmd.h>
+#include "debug.h"
+#include "internal.h"
+
+#define RCMD_DEFPATH "/bin:/usr/bin" /*used when PATH isn't set, as execvp does*/
+
+struct runcmd_cmd_t {
+    char *buf; /*the words of the command*/
+    char **argv; /*points into buf*/
+    char *path; /*the executable, NULL if it wasn't found (execvp reports it)*/
+    int nonblock;
+};
+
+/*1 if path is a regular file we can execute*/
+static int rcmd_executable (const char *path) {
+    struct stat st;
+    return stat (path, &st) == 0 && S_ISREG (st.st_mode) && access (path, X_OK) == 0;
+}
+
+/*the file execvp would run for name, NULL if there's none (or in case of error)*/
+static char *rcmd_resolve (const char *name) {
+    const char *dirs, *end;
+    size_t dlen, nlen = strlen (name);
+    char *path;
+
+    if (strchr (name, '/') != NULL) {
+        path = malloc (nlen + 1);
+        sysfail (path==NULL, NULL);
+        strcpy (path, name);
+        return path;
+    }
+
+    dirs = getenv ("PATH");
+    if (dirs == NULL)
+        dirs = RCMD_DEFPATH;
+    for (;;) {
+        end = strchr (dirs, ':');
+        dlen = end ? (size_t) (end - dirs) : strlen (dirs);
+
+        path = malloc (dlen + nlen + 3);
+        sysfail (path==NULL, NULL);
+        /*an empty entry is the current directory*/
+        if (dlen == 0)
+            strcpy (path, ".");
+        else {
+            memcpy (path, dirs, dlen);
+            path[dlen] = '\0';
+        }
+        strcat (path, "/");
+        strcat (path, name);
+        if (rcmd_executable (path))
+            return path;
+        free (path);
+
+        if (end == NULL)
+            return NULL;
+        dirs = end + 1;
+    }
+}
+
+runcmd_cmd_t *runcmd_prepare (const char *command) {
+    char *args[RCMD_MAXARGS];
+    runcmd_cmd_t *cmd;
+    int argc;
+
+    cmd = calloc (1, sizeof (runcmd_cmd_t));
+    sysfail (cmd==NULL, NULL);
+    argc = rcmd_split (command, &cmd->buf, args);
+    if (argc <= 0) {
+        if (argc == 0)
+            errno = EINVAL;
+        free (cmd->buf);
+        free (cmd);
+        return NULL;
+    }
+
+    cmd->argv = malloc ((argc + 1) * sizeof (char *));
+    if (cmd->argv == NULL) {
+        runcmd_cmd_free (cmd);
+        return NULL;
+    }
+    memcpy (cmd->argv, args, (argc + 1) * sizeof (char *));
+    cmd->nonblock = rcmd_nonblock (command);
+    cmd->path = rcmd_resolve (cmd->argv[0]);
+    return cmd;
+}
+
+int runcmd_exec (runcmd_cmd_t *cmd, runcmd_info_t *info, const int *io, const runcmd_attr_t *attr) {
+    return rcmd_run (cmd->path, cmd->argv, cmd->nonblock, info, io, attr, NULL, NULL);
+}
+
+void runcmd_cmd_free (runcmd_cmd_t *cmd) {
+    if (cmd == NULL)
+        return ;
+    free (cmd->buf);
+    free (cmd->argv);
+    free (cmd->path);
+    free (cmd);
+}
@@ -17,179 +17,1875 @@
     along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
 
  */
+#define _GNU_SOURCE /*clone and vfork*/
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <stdint.h>
 #include <signal.h>
+#include <time.h>
 #include <runcmd.h>
 #include <fcntl.h>
+#include <spawn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#endif
 #include "debug.h"
+#include "internal.h"
 
-/*
-TODO: use insque and remque in <search.h> 
- */
+/*stack given to the child when spawning with clone, it lives in the parent's frame
+ which is suspended until the child calls exec or exits*/
+#define RCMD_CLONE_STACK (64 * 1024)
 
-/*list of callback functions for nonblocking executions of runcmd*/
-typedef struct nonblocking_callback_t {
+#define RCMD_TABLE_MIN 64 /*initial number of buckets of the children table*/
+
+/*a child registered by runcmd, found by its pid in the children table*/
+typedef struct rcmd_node_t {
     pid_t pid; /*child process pid*/
-    struct nonblocking_callback_t *next; /*pointer to the next if this is set to NULL this is the last one*/
+    struct rcmd_node_t *next; /*next node in the same bucket (or in the free list)*/
     void (*runcmd_onexit) (void);
-} nonblocking_callback_t;
+    void (*exited) (const runcmd_info_t *, void *); /*called instead of runcmd_onexit if set*/
+    runcmd_done_t done; /*called instead of runcmd_onexit if set (with ptr)*/
+    void *ptr; /*given to exited*/
+    char blocking; /*a blocking runcmd is waiting for this child, the node lives in its stack*/
+    char joinable; /*kept in rcmd_zombies once reaped, see runcmd_wait_any*/
+    volatile sig_atomic_t reaped; /*set when a blocking (or joinable) child is reaped*/
+    struct timespec exec; /*when exec was done, for info.run_time*/
+    runcmd_info_t info;
+
+    /*children with a timeout are also in the rcmd_timed list*/
+    struct rcmd_node_t *tnext;
+    struct timespec deadline; /*when the next escalation signal is sent*/
+    int step, nescalate; /*next and number of escalation steps*/
+    int signals[RCMD_ESCALATE_MAX];
+    long delays[RCMD_ESCALATE_MAX];
+    pid_t pgid; /*if not 0, the process group that is signaled*/
+    char timed_out;
+    struct rcmd_node_t *group; /*timeout shared with other children, see rcmd_group_timeout*/
+    int members; /*of a group timeout, children still pointing to it*/
+
+    /*a child reaped before its thread registered it waits in rcmd_early*/
+    int status;
+    struct rusage ru;
+} rcmd_node_t;
+
+/*
+   children table, a hash of pid -> node with rcmd_table_size buckets (always a power of 2)
+   it is changed by the SIGCHLD handler, so SIGCHLD must be blocked while changing it elsewhere
+ */
+rcmd_node_t **rcmd_table = NULL;
+size_t rcmd_table_size = 0;
+size_t rcmd_nchildren = 0;
+
+/*when rcmd_reap started, for the reap latency*/
+struct timespec rcmd_reap_start;
+
+/*1 while rcmd_reap runs, children registered then (by exited callbacks) don't grow the table*/
+volatile sig_atomic_t rcmd_reaping = 0;
+
+/*nodes of reaped nonblocking children, the handler can't call free*/
+rcmd_node_t *rcmd_free_nodes = NULL;
+size_t rcmd_nfree = 0;
+
+/*
+   threads spawning (or reading the output of) a child that isn't in the table yet,
+   while there are any, unknown children that are reaped are kept in rcmd_early
+ */
+int rcmd_npending = 0;
+rcmd_node_t *rcmd_early = NULL;
+
+/*joinable children that were reaped, until runcmd_wait_any or runcmd_wait_all collects them*/
+rcmd_node_t *rcmd_zombies = NULL;
+
+/*
+   the registry (the table and every list here) is shared by all the threads, it is
+   changed holding rcmd_mutex with SIGCHLD blocked, so the handler never runs in the
+   thread that holds it; the handler doesn't wait for the mutex either, if it is 
+   taken it sets rcmd_work_pending and the holder reaps when releasing it
+   ("SIGCHLD must be blocked" in this library means rcmd_block was called)
+ */
+pthread_mutex_t rcmd_mutex;
+pthread_once_t rcmd_mutex_once = PTHREAD_ONCE_INIT;
+int rcmd_depth = 0; /*recursive, callbacks may call runcmd*/
+volatile sig_atomic_t rcmd_work_pending = 0;
+
+/*1 while the SIGCHLD handler holds the registry, it can't free memory*/
+volatile sig_atomic_t rcmd_in_handler = 0;
+
+/*what rcmd_free got inside the handler, linked through its first pointer*/
+void *rcmd_garbage = NULL;
+
+/*threads sleeping in rcmd_wait_event, woken up after each reaping*/
+typedef struct rcmd_waiter_t {
+    sem_t sem;
+    struct rcmd_waiter_t *next;
+} rcmd_waiter_t;
+
+rcmd_waiter_t *rcmd_waiters = NULL;
+
+/*in signalfd mode one waiter reads SIGCHLD (the poller), the others sleep as waiters*/
+int rcmd_polling = 0;
+pthread_t rcmd_poller;
+
+/*1 while _sigchld_handler is installed*/
+volatile sig_atomic_t rcmd_handler_installed = 0;
+
+/*event mode, see runcmd_eventfd*/
+#define RCMD_EV_NONE 0
+#define RCMD_EV_SIGNALFD 1 /*SIGCHLD is blocked and read from rcmd_evfd*/
+#define RCMD_EV_PIPE 2 /*the handler only writes a byte to rcmd_evpipe[1]*/
+#define RCMD_EV_THREAD 3 /*SIGCHLD is blocked and rcmd_reaper_main waits for it*/
+
+int rcmd_evmode = RCMD_EV_NONE;
+int rcmd_evfd = -1, rcmd_evpipe[2] = {-1, -1};
+
+/*
+   reaper mode: the callbacks of the children reaped wait in rcmd_deferred (in the
+   order they were reaped, linked by next) until the reaper thread runs them
+ */
+pthread_t rcmd_reaper;
+int rcmd_reaper_stopping = 0;
+rcmd_node_t *rcmd_deferred = NULL, *rcmd_deferred_tail = NULL;
+
+/*
+   children with a timeout, a single timer that sends SIGCHLD is armed for the
+   earliest deadline so rcmd_reap sends the signals from wherever it runs
+ */
+rcmd_node_t *rcmd_timed = NULL;
+timer_t rcmd_timer;
+int rcmd_timer_created = 0;
+
+/*information of the child whose callback is running, see runcmd_exit_info*/
+const runcmd_info_t *rcmd_exit_info = NULL;
+
+/*
+old_action stores the SIGCHLD action that was set before we start executing 
+ */
+struct sigaction old_action; 
+
+#define RCMD_HASH(pid, size) ((((unsigned int)(pid)) * 2654435761U) & ((size) - 1))
+
+/*rehashes into more buckets until there are at least size, SIGCHLD must be blocked*/
+static int rcmd_table_grow (size_t size) {
+    size_t i, nsize = rcmd_table_size ? rcmd_table_size : RCMD_TABLE_MIN;
+    rcmd_node_t **ntable, **bucket, *ptr, *aux;
+
+    if (rcmd_table_size >= size)
+        return 0;
+    while (nsize < size)
+        nsize *= 2;
+    ntable = calloc (nsize, sizeof (rcmd_node_t *));
+    sysfail (ntable==NULL, -1);
+    for (i = 0; i < rcmd_table_size; ++i) {
+        for (ptr = rcmd_table[i]; ptr != NULL; ptr = aux) {
+            aux = ptr->next;
+            bucket = &ntable[RCMD_HASH (ptr->pid, nsize)];
+            ptr->next = *bucket;
+            *bucket = ptr;
+        }
+    }
+    free (rcmd_table);
+    rcmd_table = ntable;
+    rcmd_table_size = nsize;
+    return 0;
+}
+
+/*SIGCHLD must be blocked*/
+static int rcmd_table_insert (rcmd_node_t *node) {
+    rcmd_node_t **bucket;
+
+    /*twice as many buckets when it is full, the chains just get longer inside the handler*/
+    if (rcmd_nchildren >= rcmd_table_size && !(rcmd_reaping && rcmd_table_size))
+        sysfail (rcmd_table_grow (rcmd_table_size ? rcmd_table_size * 2 : RCMD_TABLE_MIN)<0, -1);
+
+    bucket = &rcmd_table[RCMD_HASH (node->pid, rcmd_table_size)];
+    node->next = *bucket;
+    *bucket = node;
+    ++rcmd_nchildren;
+    return 0;
+}
+
+/*returns the node of pid, which is taken out of the table, or NULL if it isn't there*/
+static rcmd_node_t *rcmd_table_remove (pid_t pid) {
+    rcmd_node_t **ptr, *node;
+
+    if (rcmd_table_size == 0)
+        return NULL;
+    for (ptr = &rcmd_table[RCMD_HASH (pid, rcmd_table_size)]; *ptr != NULL; ptr = &(*ptr)->next) {
+        if ((*ptr)->pid == pid) {
+            node = *ptr;
+            *ptr = node->next;
+            --rcmd_nchildren;
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/*a node from the free list, or a new one if it is empty*/
+static rcmd_node_t *rcmd_node_get (void) {
+    rcmd_node_t *node = rcmd_free_nodes;
+
+    if (node == NULL) {
+        node = malloc (sizeof (rcmd_node_t));
+        sysfail (node==NULL, NULL);
+        return node;
+    }
+    rcmd_free_nodes = node->next;
+    --rcmd_nfree;
+    return node;
+}
+
+static void rcmd_node_put (rcmd_node_t *node) {
+    node->next = rcmd_free_nodes;
+    rcmd_free_nodes = node;
+    ++rcmd_nfree;
+}
+
+/*the node of pid in the table, NULL if it isn't there*/
+static rcmd_node_t *rcmd_table_find (pid_t pid) {
+    rcmd_node_t *node;
+
+    if (rcmd_table_size == 0)
+        return NULL;
+    for (node = rcmd_table[RCMD_HASH (pid, rcmd_table_size)]; node != NULL; node = node->next)
+        if (node->pid == pid)
+            return node;
+    return NULL;
+}
+
+/*takes the node of pid out of *list (linked by next), NULL if it isn't there*/
+static rcmd_node_t *rcmd_list_take (rcmd_node_t **list, pid_t pid) {
+    rcmd_node_t **ptr, *node;
+
+    for (ptr = list; *ptr != NULL; ptr = &(*ptr)->next) {
+        if ((*ptr)->pid == pid) {
+            node = *ptr;
+            *ptr = node->next;
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/*the node of pid if another thread reaped it before it was registered, NULL otherwise*/
+static rcmd_node_t *rcmd_claim (pid_t pid) {
+    return rcmd_list_take (&rcmd_early, pid);
+}
+
+/*ts += ms milliseconds*/
+static void rcmd_add_ms (struct timespec *ts, long ms) {
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_nsec -= 1000000000L;
+        ++ts->tv_sec;
+    }
+}
+
+/*1 if a is before b*/
+static int rcmd_before (const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/*
+   sends the escalation signals that are due and arms the timer for the next 
+   deadline (or disarms it), async-signal-safe, SIGCHLD must be blocked
+ */
+static void rcmd_expire (void) {
+    struct itimerspec its;
+    struct timespec now;
+    rcmd_node_t *node;
+    int armed = 0;
+
+    if (!rcmd_timer_created)
+        return ;
+    memset (&its, 0, sizeof its);
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    for (node = rcmd_timed; node != NULL; node = node->tnext) {
+        while (node->step < node->nescalate && !rcmd_before (&now, &node->deadline)) {
+            kill (node->pgid ? -node->pgid : node->pid, node->signals[node->step]);
+            node->timed_out = 1;
+            if (++node->step < node->nescalate)
+                rcmd_add_ms (&node->deadline, node->delays[node->step]);
+        }
+        if (node->step < node->nescalate && (!armed || rcmd_before (&node->deadline, &its.it_value))) {
+            its.it_value = node->deadline;
+            armed = 1;
+        }
+    }
+    timer_settime (rcmd_timer, TIMER_ABSTIME, &its, NULL);
+}
+
+/*copies the timeout of proc into node, SIGCHLD must be blocked, returns -1 in case of error*/
+static int rcmd_node_time (rcmd_node_t *node, const rcmd_proc_t *proc) {
+    const runcmd_attr_t *attr = proc->attr;
+    struct sigevent sev;
+    int i;
+
+    node->timed_out = 0;
+    node->nescalate = 0;
+    if (attr == NULL || attr->timeout <= 0 || attr->nescalate <= 0)
+        return 0;
+
+    if (!rcmd_timer_created) {
+        memset (&sev, 0, sizeof sev);
+        sev.sigev_notify = SIGEV_SIGNAL;
+        sev.sigev_signo = SIGCHLD;
+        sysfail (timer_create (CLOCK_MONOTONIC, &sev, &rcmd_timer) < 0, -1);
+        rcmd_timer_created = 1;
+    }
+
+    node->step = 0;
+    node->nescalate = attr->nescalate < RCMD_ESCALATE_MAX ? attr->nescalate : RCMD_ESCALATE_MAX;
+    for (i = 0; i < node->nescalate; ++i) {
+        node->signals[i] = attr->escalate[i].signal;
+        node->delays[i] = attr->escalate[i].delay;
+    }
+    node->pgid = !attr->pgroup ? 0 : attr->pgid ? attr->pgid : proc->pid;
+    node->deadline = proc->start;
+    rcmd_add_ms (&node->deadline, attr->timeout);
+    return 0;
+}
+
+/*puts node in the timed list if it has a timeout, after it is in the table*/
+static void rcmd_node_watch (rcmd_node_t *node) {
+    if (node->nescalate == 0)
+        return ;
+    node->tnext = rcmd_timed;
+    rcmd_timed = node;
+    rcmd_expire ();
+}
+
+/*takes node out of the timed list, the timer is disarmed with the last one*/
+static void rcmd_node_unwatch (rcmd_node_t *node) {
+    struct itimerspec its;
+    rcmd_node_t **ptr;
+
+    if (node->nescalate == 0)
+        return ;
+    for (ptr = &rcmd_timed; *ptr != NULL; ptr = &(*ptr)->tnext) {
+        if (*ptr == node) {
+            *ptr = node->tnext;
+            break;
+        }
+    }
+    if (rcmd_timed == NULL) {
+        memset (&its, 0, sizeof its);
+        timer_settime (rcmd_timer, 0, &its, NULL);
+    }
+}
+
+/*a child whose group timeout is gone, which is dropped with its last member*/
+static void rcmd_group_leave (rcmd_node_t *group) {
+    if (--group->members > 0)
+        return ;
+    rcmd_node_unwatch (group);
+    rcmd_node_put (group);
+}
+
+/*d = to - from*/
+static void rcmd_elapsed (struct timespec *d, const struct timespec *from, const struct timespec *to) {
+    d->tv_sec = to->tv_sec - from->tv_sec;
+    d->tv_nsec = to->tv_nsec - from->tv_nsec;
+    if (d->tv_nsec < 0) {
+        d->tv_nsec += 1000000000L;
+        --d->tv_sec;
+    }
+}
+
+/*what is known about a child before it finishes*/
+static void rcmd_info_init (runcmd_info_t *info, const rcmd_proc_t *proc) {
+    memset (info, 0, sizeof (runcmd_info_t));
+    info->pid = proc->pid;
+    info->exec_errno = proc->exec_err;
+    rcmd_elapsed (&info->spawn_time, &proc->start, &proc->exec);
+}
+
+/*the rest, once it was reaped (only async-signal-safe calls)*/
+static void rcmd_info_exit (runcmd_info_t *info, const struct timespec *exec, int status, const struct rusage *ru) {
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    rcmd_elapsed (&info->run_time, exec, &now);
+    info->status = status;
+    info->result = rcmd_result (status, info->exec_errno);
+    if (WIFSIGNALED (status)) {
+        info->signal = WTERMSIG (status);
+#ifdef WCOREDUMP
+        info->core = WCOREDUMP (status) ? 1 : 0;
+#endif
+    }
+    if (ru != NULL) {
+        info->utime = ru->ru_utime;
+        info->stime = ru->ru_stime;
+        info->maxrss = ru->ru_maxrss;
+        info->minflt = ru->ru_minflt;
+        info->majflt = ru->ru_majflt;
+        info->nvcsw = ru->ru_nvcsw;
+        info->nivcsw = ru->ru_nivcsw;
+    }
+}
+
+/*
+   queues the callback of node for the reaper thread, the node itself unless it is
+   joinable (then a copy, the node goes to rcmd_zombies), SIGCHLD must be blocked
+ */
+static int rcmd_defer (rcmd_node_t *node) {
+    rcmd_node_t *call = node;
+
+    if (node->joinable) {
+        /*not from the free list, those nodes are kept for rcmd_early*/
+        call = malloc (sizeof (rcmd_node_t));
+        sysfail (call==NULL, -1);
+        *call = *node;
+        node->reaped = 1;
+        node->next = rcmd_zombies;
+        rcmd_zombies = node;
+    }
+    call->next = NULL;
+    if (rcmd_deferred_tail != NULL)
+        rcmd_deferred_tail->next = call;
+    else
+        rcmd_deferred = call;
+    rcmd_deferred_tail = call;
+    /*
+       a caller that claims an early node queues it from its own thread, the
+       reaper may be in sigwaitinfo with nothing else coming (it stays pending)
+     */
+    if (!pthread_equal (rcmd_reaper, pthread_self ()))
+        pthread_kill (rcmd_reaper, SIGCHLD);
+    return 0;
+}
+
+/*
+   reaps every child that has finished, signals CAN be merged so one SIGCHLD 
+   may stand for any number of children
+ */
+int rcmd_child_exited (pid_t pid, int status, const struct rusage *ru) {
+    rcmd_node_t *node = rcmd_table_remove (pid);
+    const runcmd_info_t *prev = rcmd_exit_info;
+    struct timespec now, latency;
+    runcmd_info_t info;
+
+    if (node == NULL) {
+        /*maybe a child of a thread that hasn't registered it yet, it claims the node*/
+        if (rcmd_npending > 0 && rcmd_free_nodes != NULL) {
+            node = rcmd_node_get ();
+            node->pid = pid;
+            node->status = status;
+            if (ru != NULL)
+                node->ru = *ru;
+            else
+                memset (&node->ru, 0, sizeof (struct rusage));
+            node->next = rcmd_early;
+            rcmd_early = node;
+        }
+        return 0;
+    }
+    rcmd_node_unwatch (node);
+    if (node->group != NULL) {
+        if (node->group->timed_out)
+            node->timed_out = 1;
+        rcmd_group_leave (node->group);
+        node->group = NULL;
+    }
+    rcmd_info_exit (&node->info, &node->exec, status, ru);
+    if (node->timed_out)
+        node->info.result |= TIMEDOUT;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    rcmd_elapsed (&latency, &rcmd_reap_start, &now);
+    rcmd_stats_exit (&node->info, rcmd_reaping ? &latency : NULL);
+    if (node->blocking) {
+        node->reaped = 1;
+        return 1;
+    }
+    rcmd_stats_outstanding (-1);
+    /*in reaper mode the callbacks of the caller wait for the reaper thread*/
+    if (rcmd_evmode == RCMD_EV_THREAD && node->exited == NULL && (node->done || node->runcmd_onexit)
+            && rcmd_defer (node) == 0)
+        return 1;
+    /*freed first, exited may register another child in its place*/
+    info = node->info;
+    if (node->joinable) {
+        node->reaped = 1;
+        node->next = rcmd_zombies;
+        rcmd_zombies = node;
+    }
+    else
+        rcmd_node_put (node);
 
-nonblocking_callback_t *nonblocking_callback_list = NULL;
+    rcmd_exit_info = &info;
+    if (node->exited)
+        node->exited (&info, node->ptr);
+    else if (node->done)
+        node->done (info.pid, info.result, node->ptr);
+    else if (node->runcmd_onexit)
+        node->runcmd_onexit();
+    rcmd_exit_info = prev;
+    return 1;
+}
+
+const runcmd_info_t *runcmd_exit_info (void) {
+    return rcmd_exit_info;
+}
+
+/*wakes up every thread sleeping in rcmd_wait_event (async-signal-safe)*/
+static void rcmd_wake (void) {
+    rcmd_waiter_t *waiter;
+
+    for (waiter = rcmd_waiters; waiter != NULL; waiter = waiter->next)
+        sem_post (&waiter->sem);
+    /*the poller only wakes up with a SIGCHLD, and the one it waited for may be gone*/
+    if (rcmd_polling && !pthread_equal (rcmd_poller, pthread_self ()))
+        pthread_kill (rcmd_poller, SIGCHLD);
+}
+
+static int rcmd_reap (void) {
+    struct rusage ru;
+    pid_t pid;
+    int status, count = 0;
+
+    rcmd_reaping = 1;
+    clock_gettime (CLOCK_MONOTONIC, &rcmd_reap_start);
+    while ((pid = wait4 (-1, &status, WNOHANG, &ru)) > 0)
+        count += rcmd_child_exited (pid, status, &ru);
 
+    /*children of the fork server aren't ours, it tells us when they finish*/
+    if (rcmd_forksrv_exit >= 0)
+        count += rcmd_forksrv_reap ();
+    /*the timer sends SIGCHLD too*/
+    if (rcmd_timed != NULL)
+        rcmd_expire ();
+    rcmd_reaping = 0;
+
+    /*the handler stays installed when the table drains, see runcmd_sigchld_restore*/
+    rcmd_wake ();
+    return count;
+}
+
+static void rcmd_mutex_init (void) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init (&attr);
+    pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init (&rcmd_mutex, &attr);
+    pthread_mutexattr_destroy (&attr);
+}
+
+/*takes the registry, SIGCHLD must be blocked in this thread already*/
+static void rcmd_lock (void) {
+    pthread_once (&rcmd_mutex_once, rcmd_mutex_init);
+    pthread_mutex_lock (&rcmd_mutex);
+    ++rcmd_depth;
+}
 
 /*
-old_handler stores the handler function that was set before we start executing 
+   releases the registry, doing first what a handler left for us;
+   children stashed in rcmd_early that nobody can claim any more are dropped
  */
-void (*old_handler) (int) = NULL; 
+static void rcmd_unlock (void) {
+    rcmd_node_t *node;
+    void *ptr;
+    int outer, handler;
+
+    for (;;) {
+        outer = rcmd_depth == 1;
+        while (outer && rcmd_work_pending) {
+            rcmd_work_pending = 0;
+            /*in pipe mode the waiters reap (or runcmd_dispatch does)*/
+            if (rcmd_evmode == RCMD_EV_PIPE)
+                rcmd_wake ();
+            else
+                rcmd_reap ();
+        }
+        while (outer && rcmd_npending == 0 && rcmd_early != NULL) {
+            node = rcmd_early;
+            rcmd_early = node->next;
+            rcmd_node_put (node);
+        }
+        while (outer && !rcmd_in_handler && rcmd_garbage != NULL) {
+            ptr = rcmd_garbage;
+            rcmd_garbage = *(void **) ptr;
+            free (ptr);
+        }
+        handler = rcmd_in_handler;
+        if (outer)
+            rcmd_in_handler = 0;
+        --rcmd_depth;
+        pthread_mutex_unlock (&rcmd_mutex);
+
+        /*a handler may have given up on the mutex right before it was released*/
+        if (!outer || !rcmd_work_pending || pthread_mutex_trylock (&rcmd_mutex) != 0)
+            return ;
+        ++rcmd_depth;
+        rcmd_in_handler = handler;
+    }
+}
 
-/**/
+/*
+   pthread_mutex_trylock and sem_post are the only calls that aren't plain system
+   calls here, the mutex is never held by the thread the handler interrupts
+ */
 void _sigchld_handler (int sig, siginfo_t *p_info, void *vptr) {
+    int err = errno;
 
-    nonblocking_callback_t *ptr = nonblocking_callback_list, *ptr_prv=NULL, *ptr_aux=NULL;
-    int status=0;
-    /*we have to go thru all the children and check if it's dead*/
-
-    /*This is VERY UGLY!!!*/
-    while (ptr != NULL) {
-        /* WNOHANG returns immediately if nothing happend to the process
-           waitpid returns 0 if nothing happend
-           */
-        if (waitpid (ptr->pid, &status, WNOHANG)) {
-            ptr->runcmd_onexit();
-            if (ptr_prv)
-                ptr_prv->next=ptr->next;
-            else nonblocking_callback_list=ptr->next;
-            ptr_aux = ptr;
-            ptr=ptr_prv;
-            free (ptr_aux);
-        }
-        ptr_prv=ptr;
-        ptr = (ptr) ? ptr->next : NULL;
-    } 
-
-    /*we enter here if there none children left, so we set the handler back to what it was*/
-    if (nonblocking_callback_list==NULL) {
-        struct sigaction act;
-        memset (&act, 0, sizeof act);
-        act.sa_handler = old_handler; 
-        sigaction (SIGCHLD, &act, NULL);
+    /*event mode, runcmd_dispatch does the reaping*/
+    if (rcmd_evmode == RCMD_EV_PIPE)
+        write (rcmd_evpipe[1], "", 1);
+
+    /*whoever has the registry reaps when releasing it*/
+    rcmd_work_pending = 1;
+    if (pthread_mutex_trylock (&rcmd_mutex) == 0) {
+        ++rcmd_depth;
+        rcmd_in_handler = 1;
+        rcmd_unlock ();
+    }
+    errno = err;
+}
+
+/*SIGCHLD must be blocked, once installed the handler stays until runcmd_sigchld_restore*/
+static int rcmd_install_handler (void) {
+    struct sigaction act;
+
+    if (rcmd_handler_installed)
+        return 0;
+
+    memset (&act, 0, sizeof act);
+    act.sa_flags = SA_SIGINFO | SA_NOCLDSTOP;
+    act.sa_sigaction = _sigchld_handler; 
+    sigemptyset (&act.sa_mask);
+
+    /*assign void _sig_handler(int) to SIGCHLD*/
+    sysfail (sigaction(SIGCHLD, &act, &old_action)<0, -1);
+    rcmd_handler_installed = 1;
+    /*another thread may have let a SIGCHLD go while there was no handler*/
+    rcmd_work_pending = 1;
+    return 0;
+}
+
+int runcmd_sigchld_restore (void) {
+    sigset_t omask, cmask;
+    int aux = 0;
+
+    rcmd_block (&omask, &cmask);
+    /*the handler is still needed for the children that are running*/
+    if (rcmd_evmode == RCMD_EV_NONE && rcmd_handler_installed) {
+        if (rcmd_nchildren > 0 || rcmd_npending > 0)
+            aux = -1;
+        else {
+            sigaction (SIGCHLD, &old_action, NULL);
+            rcmd_handler_installed = 0;
+        }
+    }
+    rcmd_unblock (&omask);
+    if (aux < 0)
+        errno = EBUSY;
+    return aux;
+}
+
+void rcmd_free (void *ptr) {
+    if (!rcmd_in_handler) {
+        free (ptr);
+        return ;
     }
+    *(void **) ptr = rcmd_garbage;
+    rcmd_garbage = ptr;
 }
 
-void register_child_callback (pid_t pid) {
-    nonblocking_callback_t *new_head = malloc (sizeof (nonblocking_callback_t));
-    new_head->runcmd_onexit = runcmd_onexit;
-    new_head->next = nonblocking_callback_list;
-    new_head->pid = pid;
-    nonblocking_callback_list = new_head;
+int rcmd_unlock_pending (void) {
+    /*a node for the child in case another thread reaps it*/
+    if (rcmd_nfree <= (size_t) rcmd_npending)
+        sysfail (rcmd_reserve (1)<0, -1);
+    ++rcmd_npending;
+    rcmd_unlock ();
+    return 0;
+}
+
+void rcmd_lock_pending (void) {
+    rcmd_lock ();
+    --rcmd_npending;
+}
+
+int rcmd_reserve (size_t n) {
+    rcmd_node_t *node;
+    size_t i;
+
+    for (i = 0; i < n; ++i) {
+        node = malloc (sizeof (rcmd_node_t));
+        sysfail (node==NULL, -1);
+        rcmd_node_put (node);
+    }
+    /*grow the table now, not from the handler*/
+    return rcmd_table_grow (rcmd_nchildren + n + 1);
+}
+
+static int rcmd_register_node (const rcmd_proc_t *proc, void (*exited) (const runcmd_info_t *, void *), runcmd_done_t done, void *ptr) {
+    rcmd_node_t *node, *early;
+
+    /*in event mode runcmd_dispatch calls the callback, before the insertion so a failure leaves nothing behind*/
+    if (rcmd_evmode == RCMD_EV_NONE)
+        sysfail (rcmd_install_handler ()<0, -1);
+    node = rcmd_node_get ();
+    sysfail (node==NULL, -1);
+    node->pid = proc->pid;
+    node->blocking = 0;
+    node->joinable = proc->attr != NULL && proc->attr->joinable;
+    node->reaped = 0;
+    node->exec = proc->exec;
+    node->group = NULL;
+    rcmd_info_init (&node->info, proc);
+    if (rcmd_node_time (node, proc) < 0) {
+        rcmd_node_put (node);
+        return -1;
+    }
+    node->runcmd_onexit = done ? NULL : runcmd_onexit;
+    node->exited = exited;
+    node->done = done;
+    node->ptr = ptr;
+    if (rcmd_table_insert (node) < 0) {
+        rcmd_node_put (node);
+        return -1;
+    }
+    rcmd_node_watch (node);
+    rcmd_stats_outstanding (1);
+
+    /*it is over already, its callback runs right here*/
+    early = rcmd_claim (proc->pid);
+    if (early != NULL) {
+        rcmd_child_exited (early->pid, early->status, &early->ru);
+        rcmd_node_put (early);
+    }
+    return 0;
+}
+
+int rcmd_group_timeout (pid_t pgid, const runcmd_info_t *members, int n, const struct timespec *start, const runcmd_attr_t *attr) {
+    rcmd_node_t *group, *node;
+    rcmd_proc_t proc;
+    int i;
+
+    proc.pid = pgid;
+    proc.start = *start;
+    proc.attr = attr;
+    group = rcmd_node_get ();
+    sysfail (group==NULL, -1);
+    if (rcmd_node_time (group, &proc) < 0) {
+        rcmd_node_put (group);
+        return -1;
+    }
+    group->pid = group->pgid = pgid;
+    group->members = 0;
+    for (i = 0; i < n && group->nescalate > 0; ++i) {
+        node = rcmd_table_find (members[i].pid);
+        /*the ones reaped already are left out*/
+        if (node != NULL && !node->blocking && node->group == NULL) {
+            node->group = group;
+            ++group->members;
+        }
+    }
+    if (group->members == 0) {
+        rcmd_node_put (group);
+        return 0;
+    }
+    rcmd_node_watch (group);
+    return 0;
+}
+
+int rcmd_register (const rcmd_proc_t *proc, void (*exited) (const runcmd_info_t *, void *), void *ptr) {
+    return rcmd_register_node (proc, exited, NULL, ptr);
+}
+
+int rcmd_register_done (const rcmd_proc_t *proc, runcmd_done_t done, void *user_data) {
+    return rcmd_register_node (proc, NULL, done, user_data);
+}
+
+int register_child_callback (const rcmd_proc_t *proc) {
+    return rcmd_register_node (proc, NULL, NULL, NULL);
 }
 
 /*
-if runcmd returns -1, it could be pipe error, fork error, or wait for child process error
-if *io is not NULL it should have 3 entries, otherwise we will have segmentation fault
+   rcmd_wait_event until *deadline (CLOCK_MONOTONIC) if it isn't NULL,
+   returns -1 with errno ETIMEDOUT once it has passed
  */
-int runcmd (const char *command, int *result, const int *io) {
+static int rcmd_wait_until (const sigset_t *omask, const struct timespec *deadline) {
+    struct timespec now, left, abs;
+    rcmd_waiter_t self, **ptr;
+    sigset_t wmask;
+    int aux = 0, err = 0;
+
+    if (deadline != NULL) {
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        if (rcmd_before (deadline, &now))
+            left.tv_sec = left.tv_nsec = 0;
+        else
+            rcmd_elapsed (&left, &now, deadline);
+    }
+
+    /*nobody reaps yet, let the handler do it from now on*/
+    if (rcmd_evmode == RCMD_EV_NONE && !rcmd_handler_installed)
+        return rcmd_install_handler ();
+
+    /*SIGCHLD is blocked, so it waits for us (the fork server sends it as well)*/
+    if (rcmd_evmode == RCMD_EV_SIGNALFD && !rcmd_polling) {
+        sigemptyset (&wmask);
+        sigaddset (&wmask, SIGCHLD);
+        rcmd_polling = 1;
+        rcmd_poller = pthread_self ();
+        rcmd_unlock ();
+        if (deadline == NULL && sigwaitinfo (&wmask, NULL) < 0 && errno != EINTR)
+            aux = -1;
+        if (deadline != NULL && sigtimedwait (&wmask, NULL, &left) < 0 && errno != EINTR) {
+            aux = -1;
+            err = errno == EAGAIN ? ETIMEDOUT : errno;
+        }
+        rcmd_lock ();
+        rcmd_polling = 0;
+        rcmd_reap ();
+        if (err != 0)
+            errno = err;
+        return aux;
+    }
+
+    /*sem_timedwait takes CLOCK_REALTIME*/
+    if (deadline != NULL) {
+        clock_gettime (CLOCK_REALTIME, &abs);
+        abs.tv_sec += left.tv_sec;
+        rcmd_add_ms (&abs, left.tv_nsec / 1000000L);
+    }
+
+    /*the handler (or the poller) posts the semaphore after reaping*/
+    sysfail (sem_init (&self.sem, 0, 0)<0, -1);
+    self.next = rcmd_waiters;
+    rcmd_waiters = &self;
+    wmask = *omask;
+    if (rcmd_evmode != RCMD_EV_SIGNALFD && rcmd_evmode != RCMD_EV_THREAD)
+        sigdelset (&wmask, SIGCHLD);
+    rcmd_unlock ();
+    pthread_sigmask (SIG_SETMASK, &wmask, NULL);
+    /*any signal wakes us up, as sigsuspend would*/
+    if (deadline == NULL)
+        sem_wait (&self.sem);
+    else if (sem_timedwait (&self.sem, &abs) < 0 && errno == ETIMEDOUT)
+        aux = -1;
+    sigaddset (&wmask, SIGCHLD);
+    pthread_sigmask (SIG_SETMASK, &wmask, NULL);
+    rcmd_lock ();
 
-    int i, pipers, pipefd[2], aux, status, tmp_result;
-    char *cmd;
+    for (ptr = &rcmd_waiters; *ptr != &self; ptr = &(*ptr)->next)
+        ;
+    *ptr = self.next;
+    sem_destroy (&self.sem);
+    if (rcmd_evmode == RCMD_EV_PIPE)
+        rcmd_reap ();
+    if (aux < 0)
+        errno = ETIMEDOUT;
+    return aux;
+}
+
+int rcmd_wait_event (const sigset_t *omask) {
+    return rcmd_wait_until (omask, NULL);
+}
+
+int rcmd_direct_wait (void) {
+    /*in event mode the reaping is done where the caller says, SIGCHLD stays blocked*/
+    return !rcmd_handler_installed || rcmd_evmode != RCMD_EV_NONE;
+}
+
+void rcmd_child_reaped (const rcmd_proc_t *proc, int status, runcmd_info_t *info) {
+    rcmd_info_init (info, proc);
+    rcmd_info_exit (info, &proc->exec, status, NULL);
+    rcmd_stats_exit (info, NULL);
+}
+
+int rcmd_wait_child (const rcmd_proc_t *proc, runcmd_info_t *info, const sigset_t *omask) {
+    struct rusage ru;
+    rcmd_node_t node, *early;
+    int status, direct, err;
     pid_t pid;
 
+    sysfail (rcmd_node_time (&node, proc)<0, -1);
+    /*the timer wakes up the handler (or rcmd_wait_event in event mode), not wait4*/
+    if (node.nescalate > 0 && rcmd_evmode == RCMD_EV_NONE)
+        sysfail (rcmd_install_handler ()<0, -1);
+    direct = node.nescalate == 0 && rcmd_direct_wait ();
 
-    tmp_result=0;
+    /*in the table even if we wait for it, a reaper in another thread may take it*/
+    rcmd_info_init (info, proc);
+    node.pid = proc->pid;
+    node.blocking = 1;
+    node.joinable = 0;
+    node.exec = proc->exec;
+    node.info = *info;
+    node.reaped = 0;
+    node.runcmd_onexit = NULL;
+    node.exited = NULL;
+    node.done = NULL;
+    node.group = NULL;
+    sysfail (rcmd_table_insert (&node)<0, -1);
+    rcmd_node_watch (&node);
 
-    pipers = pipe(pipefd);
-    sysfail (pipers==-1, -1);
+    early = rcmd_claim (proc->pid);
+    if (early != NULL) {
+        rcmd_child_exited (early->pid, early->status, &early->ru);
+        rcmd_node_put (early);
+    }
+    else if (direct) {
+        /*nobody else is reaping, so wait for it directly*/
+        rcmd_unlock ();
+        while ((pid = wait4 (proc->pid, &status, 0, &ru)) < 0 && errno == EINTR)
+            ;
+        err = errno;
+        rcmd_lock ();
+        if (pid == proc->pid) {
+            rcmd_table_remove (proc->pid);
+            rcmd_info_exit (&node.info, &proc->exec, status, &ru);
+            rcmd_stats_exit (&node.info, NULL);
+            node.reaped = 1;
+        }
+        /*ECHILD means the fork server started it, or another thread reaped it*/
+        else if (!node.reaped && (err != ECHILD || rcmd_forksrv_exit < 0)) {
+            rcmd_table_remove (proc->pid);
+            errno = err;
+            return -1;
+        }
+    }
 
-    pid = fork();
-    sysfail (pid<0, -1);
+    while (!node.reaped) {
+        if (rcmd_wait_event (omask) < 0) {
+            rcmd_table_remove (proc->pid);
+            rcmd_node_unwatch (&node);
+            return -1;
+        }
+    }
+    *info = node.info;
+    return 0;
+}
 
-    if (pid > 0) { /*parent*/
-        char *pch; /*this is only used to get the return from memchr*/
+/*
+   looks pids up, SIGCHLD must be blocked: returns how many of them are still
+   running (they become joinable), *done gets the index of one that was reaped
+   (or -1) and *unknown how many aren't nonblocking children of runcmd
+ */
+static int rcmd_join_scan (const pid_t *pids, int n, int *done, int *unknown) {
+    rcmd_node_t *node;
+    int i, running = 0;
 
-        close (pipefd[1]); /*close writing end*/
+    *done = -1;
+    *unknown = 0;
+    for (i = 0; i < n; ++i) {
+        for (node = rcmd_zombies; node != NULL && node->pid != pids[i]; node = node->next)
+            ;
+        if (node != NULL) {
+            *done = i;
+            continue;
+        }
+        node = rcmd_table_find (pids[i]);
+        if (node != NULL && !node->blocking) {
+            node->joinable = 1;
+            ++running;
+        }
+        else
+            ++*unknown;
+    }
+    return running;
+}
 
-        /*checks if '&' is present in the string command*/
-        pch = memchr(command, RCMD_NONBLOCK, strlen(command));
-        tmp_result |= pch!=NULL ? NONBLOCK : 0;
+/*takes the reaped child pid out of rcmd_zombies*/
+static void rcmd_join (pid_t pid, runcmd_info_t *info) {
+    rcmd_node_t *node = rcmd_list_take (&rcmd_zombies, pid);
 
-        if (IS_NONBLOCK(tmp_result)) {
+    if (info)
+        *info = node->info;
+    rcmd_node_put (node);
+}
 
-            struct sigaction act, oact;
-            sigaction (SIGCHLD, NULL, &oact);
+pid_t runcmd_wait_any (const pid_t *pids, int n, runcmd_info_t *info, long timeout) {
+    struct timespec deadline;
+    sigset_t omask, cmask;
+    int running, done, unknown, aux = 0, err = 0;
+    pid_t pid = 0;
 
-            if (oact.sa_sigaction != _sigchld_handler) {
-                old_handler = oact.sa_handler;
-            }
+    if (timeout >= 0) {
+        clock_gettime (CLOCK_MONOTONIC, &deadline);
+        rcmd_add_ms (&deadline, timeout);
+    }
+    rcmd_block (&omask, &cmask);
+    while ((running = rcmd_join_scan (pids, n, &done, &unknown)) > 0 && done < 0 && aux == 0)
+        aux = rcmd_wait_until (&omask, timeout >= 0 ? &deadline : NULL);
+    if (done >= 0) {
+        pid = pids[done];
+        rcmd_join (pid, info);
+    }
+    else if (running == 0) {
+        pid = -1;
+        err = ECHILD;
+    }
+    /*still running once the timeout expired*/
+    else if (errno != ETIMEDOUT) {
+        pid = -1;
+        err = errno;
+    }
+    rcmd_unblock (&omask);
+    if (pid < 0)
+        errno = err;
+    return pid;
+}
 
-            memset (&act, 0, sizeof act);
-            act.sa_flags = SA_SIGINFO;
-            act.sa_sigaction = _sigchld_handler; 
+int runcmd_wait_all (const pid_t *pids, int n, runcmd_info_t *infos, long timeout) {
+    struct timespec deadline;
+    sigset_t omask, cmask;
+    int i, running, done, unknown, aux = 0, err = 0;
 
-            /*register a callback for the child with the current runcmd_onexit as callback function*/
-            register_child_callback (pid);
+    if (timeout >= 0) {
+        clock_gettime (CLOCK_MONOTONIC, &deadline);
+        rcmd_add_ms (&deadline, timeout);
+    }
+    rcmd_block (&omask, &cmask);
+    while ((running = rcmd_join_scan (pids, n, &done, &unknown)) > 0 && unknown == 0 && aux == 0)
+        aux = rcmd_wait_until (&omask, timeout >= 0 ? &deadline : NULL);
+    if (unknown > 0) {
+        running = -1;
+        err = ECHILD;
+    }
+    else if (running == 0) {
+        for (i = 0; i < n; ++i)
+            rcmd_join (pids[i], infos ? &infos[i] : NULL);
+    }
+    else if (errno != ETIMEDOUT) {
+        running = -1;
+        err = errno;
+    }
+    rcmd_unblock (&omask);
+    if (running < 0)
+        errno = err;
+    return running;
+}
+
+int runcmd_eventfd (void) {
+    sigset_t chld, omask, cmask;
+    int flags;
+
+    /*the reaper thread already takes SIGCHLD*/
+    if (rcmd_evmode == RCMD_EV_THREAD) {
+        errno = EBUSY;
+        return -1;
+    }
+    if (rcmd_evmode != RCMD_EV_NONE)
+        return rcmd_evfd;
+
+    sigemptyset (&chld);
+    sigaddset (&chld, SIGCHLD);
+
+#ifdef __linux__
+    /*SIGCHLD stays pending until runcmd_dispatch, so no handler runs at all*/
+    sigprocmask (SIG_BLOCK, &chld, NULL);
+    rcmd_evfd = signalfd (-1, &chld, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (rcmd_evfd >= 0) {
+        rcmd_evmode = RCMD_EV_SIGNALFD;
+        return rcmd_evfd;
+    }
+    sigprocmask (SIG_UNBLOCK, &chld, NULL);
+#endif
+
+    /*no signalfd, the handler wakes up the caller through a pipe*/
+    sysfail (pipe (rcmd_evpipe) < 0, -1);
+    for (flags = 0; flags < 2; ++flags) {
+        fcntl (rcmd_evpipe[flags], F_SETFL, fcntl (rcmd_evpipe[flags], F_GETFL) | O_NONBLOCK);
+        fcntl (rcmd_evpipe[flags], F_SETFD, FD_CLOEXEC);
+    }
+    rcmd_block (&omask, &cmask);
+    rcmd_evmode = RCMD_EV_PIPE;
+    rcmd_evfd = rcmd_evpipe[0];
+    /*it is never set back in pipe mode, so it stays installed*/
+    flags = rcmd_install_handler ();
+    rcmd_unblock (&omask);
+    sysfail (flags < 0, -1);
+    return rcmd_evfd;
+}
 
-            /*assign void _sig_handler(int) to SIGCHLD*/
-            sysfail (sigaction(SIGCHLD, &act, NULL)<0, -1);
+int runcmd_dispatch (void) {
+    char buf[512];
+    sigset_t omask, cmask;
+    int count;
+
+    sysfail (rcmd_evmode == RCMD_EV_NONE, -1);
+
+    /*empty the fd first, a child finishing after that makes it readable again*/
+    while (read (rcmd_evfd, buf, sizeof buf) > 0)
+        ;
+
+    rcmd_block (&omask, &cmask);
+    count = rcmd_reap ();
+    rcmd_unblock (&omask);
+    return count;
+}
+
+/*
+   the reaper thread: reaps after each SIGCHLD, then runs the callbacks that were
+   queued, with the registry released; it reaps again only after the last one
+ */
+static void *rcmd_reaper_main (void *arg) {
+    const runcmd_info_t *prev;
+    rcmd_node_t *node;
+    sigset_t chld;
+
+    sigemptyset (&chld);
+    sigaddset (&chld, SIGCHLD);
+    rcmd_lock ();
+    for (;;) {
+        rcmd_reap ();
+        while ((node = rcmd_deferred) != NULL) {
+            rcmd_deferred = node->next;
+            if (rcmd_deferred == NULL)
+                rcmd_deferred_tail = NULL;
+            rcmd_unlock ();
+
+            prev = rcmd_exit_info;
+            rcmd_exit_info = &node->info;
+            if (node->done)
+                node->done (node->info.pid, node->info.result, node->ptr);
+            else if (node->runcmd_onexit)
+                node->runcmd_onexit ();
+            rcmd_exit_info = prev;
+
+            rcmd_lock ();
+            if (node->joinable)
+                free (node);
+            else
+                rcmd_node_put (node);
         }
-        else {
-            aux = wait(&status); 
+        if (rcmd_reaper_stopping)
+            break;
+        /*a SIGCHLD sent meanwhile stays pending, it is blocked*/
+        rcmd_unlock ();
+        while (sigwaitinfo (&chld, NULL) < 0 && errno == EINTR)
+            ;
+        rcmd_lock ();
+    }
+    rcmd_unlock ();
+    return arg;
+}
 
-            sysfail (aux<0, -1);
-            if (WIFEXITED(status)) {
+int runcmd_reaper_start (void) {
+    sigset_t omask, cmask;
+    int aux = 0;
 
-                tmp_result |= NORMTERM | WEXITSTATUS(status);
+    rcmd_block (&omask, &cmask);
+    if (rcmd_evmode != RCMD_EV_NONE) {
+        aux = rcmd_evmode == RCMD_EV_THREAD ? 0 : -1;
+        rcmd_unblock (&omask);
+        if (aux < 0)
+            errno = EBUSY;
+        return aux;
+    }
+    /*born with SIGCHLD blocked, as this thread is now*/
+    aux = pthread_create (&rcmd_reaper, NULL, rcmd_reaper_main, NULL);
+    if (aux == 0) {
+        rcmd_evmode = RCMD_EV_THREAD;
+        /*rcmd_wake sends it SIGCHLD, the other waiters sleep on their semaphores*/
+        rcmd_polling = 1;
+        rcmd_poller = rcmd_reaper;
+        if (rcmd_handler_installed) {
+            sigaction (SIGCHLD, &old_action, NULL);
+            rcmd_handler_installed = 0;
+        }
+        sigaddset (&omask, SIGCHLD);
+    }
+    rcmd_unblock (&omask);
+    if (aux != 0) {
+        errno = aux;
+        return -1;
+    }
+    return 0;
+}
+
+void runcmd_reaper_stop (void) {
+    sigset_t omask, cmask;
+
+    rcmd_block (&omask, &cmask);
+    if (rcmd_evmode != RCMD_EV_THREAD) {
+        rcmd_unblock (&omask);
+        return ;
+    }
+    rcmd_reaper_stopping = 1;
+    pthread_kill (rcmd_reaper, SIGCHLD);
+    rcmd_unblock (&omask);
+    pthread_join (rcmd_reaper, NULL);
+
+    rcmd_block (&omask, &cmask);
+    rcmd_reaper_stopping = 0;
+    rcmd_polling = 0;
+    rcmd_evmode = RCMD_EV_NONE;
+    /*the children still running are reaped by the handler*/
+    if (rcmd_nchildren > 0 || rcmd_npending > 0)
+        rcmd_install_handler ();
+    sigdelset (&omask, SIGCHLD);
+    rcmd_unblock (&omask);
+}
+
+/*everything the child needs to get to exec*/
+typedef struct {
+    const char *path; /*NULL to search argv[0] in PATH*/
+    char *const *argv;
+    const int *io;
+    const sigset_t *mask; /*signal mask to be restored right before exec*/
+    const runcmd_attr_t *attr; /*may be NULL*/
+    char *const *envp; /*environ with the overlay of attr, NULL for environ*/
+    int shared; /*1 if the child shares the address space with the parent (vfork, clone)*/
+    int errfd; /*if not shared, exec errno is written here (CLOEXEC pipe)*/
+    volatile int err; /*if shared, exec errno is stored here*/
+} rcmd_child_t;
+
+/*1 if the variables a and b (each "NAME=value" or "NAME") have the same name*/
+static int rcmd_env_same (const char *a, const char *b) {
+    while (*a && *a != '=' && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return (*a == '\0' || *a == '=') && (*b == '\0' || *b == '=');
+}
 
-                /*this means that the child didn't write something in it, which only happens if exec fails*/
-                tmp_result |= !read(pipefd[0], &aux, 1) ? EXECOK: 0; 
+/*
+   environ with the overlay env applied, built before spawning since the child 
+   can't allocate; only the pointers are copied, the caller frees the array
+ */
+static char **rcmd_env (const char *const *env) {
+    size_t i, j, k = 0, n, m;
+    char **envp;
+
+    for (n = 0; environ[n] != NULL; ++n)
+        ;
+    for (m = 0; env[m] != NULL; ++m)
+        ;
+    envp = malloc ((n + m + 1) * sizeof (char *));
+    sysfail (envp==NULL, NULL);
+    for (i = 0; i < n; ++i) {
+        for (j = 0; j < m && !rcmd_env_same (environ[i], env[j]); ++j)
+            ;
+        if (j == m)
+            envp[k++] = environ[i];
+    }
+    for (j = 0; j < m; ++j)
+        if (strchr (env[j], '=') != NULL)
+            envp[k++] = (char *) env[j];
+    envp[k] = NULL;
+    return envp;
+}
+
+/*1 if attr has something posix_spawn can't do*/
+static int rcmd_attr_child (const runcmd_attr_t *attr) {
+    return attr && (attr->cwd || attr->umask >= 0 || attr->nice || attr->nrlimits > 0 || attr->closefds || attr->npass > 0);
+}
+
+#ifdef __linux__
+/*what getdents64 returns, name is NUL terminated*/
+struct rcmd_dirent64 {
+    uint64_t ino;
+    int64_t off;
+    unsigned short reclen;
+    unsigned char type;
+    char name[1];
+};
+#endif
+
+/*1 if fd is one of the n in keep*/
+static int rcmd_kept (int fd, const int *keep, int n) {
+    while (n-- > 0)
+        if (keep[n] == fd)
+            return 1;
+    return 0;
+}
+
+/*
+   closes every fd above 2 but the n in keep (sorted, all above 2), in the child: 
+   close_range for each gap, or else the fds listed in /proc/self/fd, or else
+   every number under the limit of open files
+ */
+static void rcmd_close_fds (const int *keep, int n) {
+    struct rlimit rl;
+    int i, fd;
+#ifdef __linux__
+    union { char buf[1024]; uint64_t align; } dir;
+    struct rcmd_dirent64 *ent;
+    long len, off;
+    const char *p;
+    int dfd;
+#ifdef SYS_close_range
+    unsigned int lo = 3;
+#endif
+
+#ifdef SYS_close_range
+    for (i = 0; i <= n; ++i) {
+        if (i == n || lo < (unsigned int) keep[i])
+            if (syscall (SYS_close_range, lo, i < n ? keep[i] - 1U : ~0U, 0) < 0)
+                break;
+        if (i < n)
+            lo = keep[i] + 1;
+    }
+    if (i > n)
+        return ;
+#endif
+
+    dfd = open ("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) {
+        while ((len = syscall (SYS_getdents64, dfd, dir.buf, sizeof dir.buf)) > 0) {
+            for (off = 0; off < len; off += ent->reclen) {
+                ent = (struct rcmd_dirent64 *) (dir.buf + off);
+                /*"." and ".." aren't numbers*/
+                for (fd = 0, p = ent->name; *p >= '0' && *p <= '9'; ++p)
+                    fd = fd * 10 + (*p - '0');
+                if (*p == '\0' && p != ent->name && fd > 2 && fd != dfd && !rcmd_kept (fd, keep, n))
+                    close (fd);
             }
         }
-        close (pipefd[0]);
-    } 
-    else { /*child*/
-        char *args[RCMD_MAXARGS], *token;
-        cmd = malloc(sizeof(char) * (strlen(command)+1));
-        strcpy(cmd, command);
+        close (dfd);
+        return ;
+    }
+#endif
 
-        close (pipefd[0]); /*close the unused pipe end*/
+    /*no /proc either*/
+    if (getrlimit (RLIMIT_NOFILE, &rl) < 0)
+        return ;
+    for (fd = 3; (rlim_t) fd < rl.rlim_cur && fd < 1 << 20; ++fd)
+        if (!rcmd_kept (fd, keep, n))
+            close (fd);
+    (void) i;
+}
+
+/*
+   io and the passed fds of the child, closing the others if asked to,
+   only async-signal-safe calls, returns -1 in case of error
+ */
+static int rcmd_child_fds (const rcmd_child_t *child) {
+    const runcmd_attr_t *attr = child->attr;
+    int i, j, fd, low = 3, npass = 0, nkeep = 0, moved[RCMD_PASS_MAX], keep[RCMD_PASS_MAX + 1];
+
+    /*the passed fds go above every target first, so no dup2 overwrites one of them*/
+    if (attr != NULL)
+        npass = attr->npass < RCMD_PASS_MAX ? attr->npass : RCMD_PASS_MAX;
+    for (i = 0; i < npass; ++i)
+        if (attr->pass[i].target >= low)
+            low = attr->pass[i].target + 1;
+    for (i = 0; i < npass; ++i)
+        if ((moved[i] = fcntl (attr->pass[i].fd, F_DUPFD_CLOEXEC, low)) < 0)
+            return -1;
+
+    /*now we have to make the file descriptors in *io to be the new stdin,stdout,stderr*/
+    if (child->io) {
+        for (i = 0;i < 3;i++) {
+            if (child->io[i] > 0 && dup2 (child->io[i], i) < 0)
+                return -1;
+        }
+    }
+    /*end of redirection of IO*/
 
-        aux = fcntl (pipefd[1], F_SETFD, FD_CLOEXEC); /*set close on exec flag*/
-        sysfail (aux==-1, -1);
-
-        /*parse the comand given*/
-        token = strtok(cmd, RCMD_DELIM);
-        for (i = 0; i < RCMD_MAXARGS && token != NULL && token[0]!='&'; ++i) {
-            args[i] = token;
-            token = strtok(NULL, RCMD_DELIM);
-        }
-        args[i] = NULL;
-
-        /*now we have to make the file descriptors in *io to be the new stdin,stdout,stderr*/
-        if (io) {
-            int std_fd[]={STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
-            for (i = 0;i < 3;i++) {
-                if (io[std_fd[i]] > 0) {
-                    aux = dup2(io[std_fd[i]], std_fd[i]);
-                    sysfail (aux<0, -1);
-                }
+    for (i = 0; i < npass; ++i)
+        if (dup2 (moved[i], attr->pass[i].target) < 0)
+            return -1;
+
+    if (attr == NULL || !attr->closefds)
+        return 0;
+    /*the targets and the exec status pipe stay, sorted for close_range*/
+    for (i = 0; i <= npass; ++i) {
+        fd = i < npass ? attr->pass[i].target : child->shared ? -1 : child->errfd;
+        if (fd < 3)
+            continue;
+        for (j = nkeep++; j > 0 && keep[j-1] > fd; --j)
+            keep[j] = keep[j-1];
+        keep[j] = fd;
+    }
+    rcmd_close_fds (keep, nkeep);
+    return 0;
+}
+
+/*applies attr in the child (only async-signal-safe calls), -1 in case of error*/
+static int rcmd_child_attr (const runcmd_attr_t *attr) {
+    int i;
+
+    if (attr->cwd && chdir (attr->cwd) < 0)
+        return -1;
+    if (attr->umask >= 0)
+        umask (attr->umask);
+    errno = 0;
+    if (attr->nice && nice (attr->nice) == -1 && errno != 0)
+        return -1;
+    for (i = 0; i < attr->nrlimits && i < RCMD_RLIMIT_MAX; ++i)
+        if (setrlimit (attr->rlimits[i].resource, &attr->rlimits[i].limit) < 0)
+            return -1;
+    return 0;
+}
+
+/*runs in the child, never returns*/
+static int rcmd_child (void *vptr) {
+    rcmd_child_t *child = vptr;
+    int i, err;
+
+    /*handlers belong to the parent, they can't run on a shared address space*/
+    if (child->shared) {
+        struct sigaction act;
+        for (i = 1; i < NSIG; ++i) {
+            if (sigaction (i, NULL, &act) == 0 && act.sa_handler != SIG_IGN && act.sa_handler != SIG_DFL) {
+                act.sa_handler = SIG_DFL;
+                act.sa_flags = 0;
+                sigaction (i, &act, NULL);
             }
         }
-        /*end of redirection of IO*/
+    }
+
+    if (child->attr && child->attr->pgroup && setpgid (0, child->attr->pgid) < 0)
+        goto exec_failed;
+
+    if (rcmd_child_fds (child) < 0)
+        goto exec_failed;
+
+    if (child->attr && rcmd_child_attr (child->attr) < 0)
+        goto exec_failed;
+
+    sigprocmask (SIG_SETMASK, child->mask, NULL);
 
-        execvp(args[0], args);
+    if (child->path)
+        execve (child->path, child->argv, child->envp ? child->envp : environ);
+    else if (child->envp)
+        execvpe (child->argv[0], child->argv, child->envp);
+    else
+        execvp (child->argv[0], child->argv);
 
-        /*if we got here, it means args[0] can't be executed :(*/
-        write (pipefd[1], "1", 1);
+    /*if we got here, it means args[0] can't be executed :(*/
+exec_failed:
+    err = errno;
+    if (child->shared)
+        child->err = err;
+    else 
+        write (child->errfd, &err, sizeof err);
+    _exit (EXECFAILSTATUS);
+    return EXECFAILSTATUS;
+}
+
+/*
+   fork + CLOEXEC status pipe, the parent blocks until the child has called exec
+ */
+static pid_t rcmd_spawn_fork (rcmd_child_t *child, int *exec_err) {
+    int pipefd[2], err;
+    pid_t pid;
+
+    sysfail (pipe (pipefd)==-1, -1);
+    if (fcntl (pipefd[1], F_SETFD, FD_CLOEXEC)==-1) { /*set close on exec flag*/
+        close (pipefd[0]);
         close (pipefd[1]);
-        free (cmd);
-        exit (EXECFAILSTATUS);
+        return -1;
+    }
+    child->errfd = pipefd[1];
+
+    pid = fork();
+    if (pid == 0) { /*child*/
+        close (pipefd[0]); /*close the unused pipe end*/
+        rcmd_child (child);
+    }
+    close (pipefd[1]); /*close writing end*/
+
+    /*the child only writes in the pipe if exec fails*/
+    if (pid > 0 && read (pipefd[0], &err, sizeof err) == sizeof err)
+        *exec_err = err;
+    close (pipefd[0]);
+    return pid;
+}
+
+/*
+   vfork and clone(CLONE_VM|CLONE_VFORK) share the parent's memory, so no page tables 
+   are copied and the exec errno comes back in child->err
+ */
+static pid_t rcmd_spawn_shared (rcmd_child_t *child, int *exec_err, int backend) {
+    sigset_t all, old;
+    pid_t pid;
+    int err;
+
+    child->shared = 1;
+    child->err = 0;
+
+    /*no handler can run in the child until it has reset them*/
+    sigfillset (&all);
+    sigprocmask (SIG_SETMASK, &all, &old);
+
+#ifdef __linux__
+    if (backend == RCMD_SPAWN_CLONE) {
+        union { char buf[RCMD_CLONE_STACK]; long double align; } stack;
+        pid = clone (rcmd_child, stack.buf + sizeof stack.buf, CLONE_VM | CLONE_VFORK | SIGCHLD, child);
+    }
+    else
+#endif
+    {
+        pid = vfork ();
+        if (pid == 0)
+            rcmd_child (child);
+    }
+    err = errno;
+    sigprocmask (SIG_SETMASK, &old, NULL);
+
+    if (pid > 0)
+        *exec_err = child->err;
+    errno = err;
+    return pid;
+}
+
+/*
+   posix_spawn doesn't give us a pid when exec fails, in that case the caller 
+   retries with other backend so a subprocess still reports the failure
+ */
+static pid_t rcmd_spawn_posix (rcmd_child_t *child, int *exec_err) {
+    posix_spawn_file_actions_t factions;
+    posix_spawnattr_t attr;
+    pid_t pid = -1;
+    int i, err;
+
+    posix_spawn_file_actions_init (&factions);
+    posix_spawnattr_init (&attr);
+    if (child->io) {
+        for (i = 0; i < 3; ++i)
+            if (child->io[i] > 0)
+                posix_spawn_file_actions_adddup2 (&factions, child->io[i], i);
+    }
+    posix_spawnattr_setsigmask (&attr, child->mask);
+    if (child->attr && child->attr->pgroup) {
+        posix_spawnattr_setpgroup (&attr, child->attr->pgid);
+        posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+    }
+    else
+        posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSIGMASK);
+
+    if (child->path)
+        err = posix_spawn (&pid, child->path, &factions, &attr, child->argv, child->envp ? child->envp : environ);
+    else
+        err = posix_spawnp (&pid, child->argv[0], &factions, &attr, child->argv, child->envp ? child->envp : environ);
+
+    posix_spawn_file_actions_destroy (&factions);
+    posix_spawnattr_destroy (&attr);
+
+    if (err != 0) {
+        *exec_err = err;
+        errno = err;
+        return -1;
     }
+    return pid;
+}
+
+/*
+   backend used by rcmd_spawn, only set by runcmd_spawn_backend with the registry 
+   held; RCMD_SPAWN_AUTO until then, which rcmd_spawn resolves on each call
+ */
+volatile sig_atomic_t rcmd_backend = RCMD_SPAWN_AUTO;
+
+/*the backend RCMD_SPAWN_AUTO stands for*/
+static int rcmd_backend_auto (void) {
+#ifdef __linux__
+    return RCMD_SPAWN_CLONE;
+#else
+    return RCMD_SPAWN_POSIX;
+#endif
+}
+
+/*
+   1 if backend creates a subprocess here (a sandbox may refuse clone or vfork),
+   tried with one whose exec fails; SIGCHLD must be blocked, so nobody else reaps it
+ */
+static int rcmd_backend_works (int backend) {
+    char *argv[] = {"/", NULL};
+    rcmd_child_t child;
+    sigset_t mask;
+    int err;
+    pid_t pid;
+
+    if (backend != RCMD_SPAWN_CLONE && backend != RCMD_SPAWN_VFORK)
+        return 1;
+    pthread_sigmask (SIG_SETMASK, NULL, &mask);
+    child.path = argv[0];
+    child.argv = argv;
+    child.io = NULL;
+    child.mask = &mask;
+    child.attr = NULL;
+    child.envp = NULL;
+    child.errfd = -1;
+    pid = rcmd_spawn_shared (&child, &err, backend);
+    if (pid < 0)
+        return 0;
+    while (waitpid (pid, NULL, 0) < 0 && errno == EINTR)
+        ;
+    return 1;
+}
+
+int runcmd_spawn_backend (int backend) {
+    sigset_t omask, cmask;
+
+    if (backend < RCMD_SPAWN_AUTO || backend > RCMD_SPAWN_POSIX)
+        return -1;
+
+    if (backend == RCMD_SPAWN_AUTO)
+        backend = rcmd_backend_auto ();
+#ifndef __linux__
+    if (backend == RCMD_SPAWN_CLONE)
+        backend = RCMD_SPAWN_FORK;
+#endif
+    rcmd_block (&omask, &cmask);
+    if (!rcmd_backend_works (backend))
+        backend = RCMD_SPAWN_FORK;
+    rcmd_backend = backend;
+    rcmd_unblock (&omask);
+    return backend;
+}
+
+/*uses the backend selected by runcmd_spawn_backend*/
+pid_t rcmd_spawn (const char *path, char *const argv[], const int *io, const sigset_t *mask, const runcmd_attr_t *attr, int *exec_err) {
+    rcmd_child_t child;
+    pid_t pid;
+    int backend, err;
+
+    backend = rcmd_backend;
+    if (backend == RCMD_SPAWN_AUTO)
+        backend = rcmd_backend_auto ();
+
+    child.path = path;
+    child.argv = argv;
+    child.io = io;
+    child.mask = mask;
+    child.attr = attr;
+    child.envp = NULL;
+    child.shared = 0;
+    child.errfd = -1;
+    *exec_err = 0;
+
+    if (rcmd_forksrv_req >= 0) {
+        pid = rcmd_forksrv_spawn (path, argv, io, mask, attr, exec_err);
+        if (pid > 0 || rcmd_forksrv_req >= 0)
+            return pid;
+        /*the server is gone, spawn it ourselves*/
+    }
+
+    if (attr && attr->env) {
+        child.envp = rcmd_env (attr->env);
+        if (child.envp == NULL)
+            return -1;
+    }
+    /*the rest of attr is done by our own child*/
+    if (backend == RCMD_SPAWN_POSIX && rcmd_attr_child (attr))
+        backend = RCMD_SPAWN_VFORK;
+
+    if (backend == RCMD_SPAWN_POSIX) {
+        pid = rcmd_spawn_posix (&child, exec_err);
+        if (pid > 0 || *exec_err == EAGAIN || *exec_err == ENOMEM)
+            goto spawned;
+        /*exec failed, let a real subprocess report it*/
+        backend = RCMD_SPAWN_VFORK;
+        *exec_err = 0;
+    }
+
+    if (backend == RCMD_SPAWN_CLONE || backend == RCMD_SPAWN_VFORK) {
+        pid = rcmd_spawn_shared (&child, exec_err, backend);
+        if (pid > 0 || errno == EAGAIN || errno == ENOMEM)
+            goto spawned;
+        /*refused by the kernel, only this call falls back (runcmd_spawn_backend probes)*/
+    }
+
+    pid = rcmd_spawn_fork (&child, exec_err);
+spawned:
+    err = errno;
+    free ((void *) child.envp);
+    errno = err;
+    return pid;
+}
+
+pid_t rcmd_start (const char *path, char *const argv[], const int *io, const sigset_t *mask, const runcmd_attr_t *attr, rcmd_proc_t *proc) {
+    clock_gettime (CLOCK_MONOTONIC, &proc->start);
+    proc->exec_err = 0;
+    proc->attr = attr;
+    proc->pid = rcmd_spawn (path, argv, io, mask, attr, &proc->exec_err);
+    clock_gettime (CLOCK_MONOTONIC, &proc->exec);
+    rcmd_stats_spawn (proc);
+    return proc->pid;
+}
+
+int rcmd_split (const char *command, char **buf, char *args[]) {
+    char *token, *saveptr;
+    int i;
+
+    *buf = malloc (sizeof(char) * (strlen(command)+1));
+    sysfail (*buf==NULL, -1);
+    strcpy (*buf, command);
+
+    /*parse the comand given*/
+    token = strtok_r (*buf, RCMD_DELIM, &saveptr);
+    for (i = 0; i < RCMD_MAXARGS-1 && token != NULL; ++i) {
+        args[i] = token;
+        token = strtok_r (NULL, RCMD_DELIM, &saveptr);
+    }
+    /*the last word, if it starts with '&', only means nonblocking mode*/
+    if (i > 0 && args[i-1][0] == RCMD_NONBLOCK)
+        --i;
+    args[i] = NULL;
+    return i;
+}
+
+/*both ends close on exec, the read end doesn't block if nonblock*/
+int rcmd_pipe (int pipefd[2], int nonblock) {
+#ifdef __linux__
+    sysfail (pipe2 (pipefd, O_CLOEXEC)<0, -1);
+#else
+    sysfail (pipe (pipefd)<0, -1);
+    fcntl (pipefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl (pipefd[1], F_SETFD, FD_CLOEXEC);
+#endif
+    /*a new pipe has no other status flags*/
+    if (nonblock)
+        fcntl (pipefd[0], F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+int rcmd_nonblock (const char *command) {
+    const char *end = command + strlen (command);
+
+    /*only the last word counts, an '&' inside an argument is just a character*/
+    while (end > command && strchr (RCMD_DELIM, end[-1]) != NULL)
+        --end;
+    while (end > command && strchr (RCMD_DELIM, end[-1]) == NULL)
+        --end;
+    return *end == RCMD_NONBLOCK;
+}
+
+void rcmd_block (sigset_t *omask, sigset_t *cmask) {
+    sigset_t chld;
+
+    /*the child can't be reaped before it is in the table*/
+    sigemptyset (&chld);
+    sigaddset (&chld, SIGCHLD);
+    pthread_sigmask (SIG_BLOCK, &chld, omask);
+    rcmd_lock ();
+
+    /*SIGCHLD was blocked by runcmd_eventfd (or runcmd_reaper_start), not by the caller*/
+    *cmask = *omask;
+    if (rcmd_evmode == RCMD_EV_SIGNALFD || rcmd_evmode == RCMD_EV_THREAD)
+        sigdelset (cmask, SIGCHLD);
+}
+
+void rcmd_unblock (const sigset_t *omask) {
+    rcmd_unlock ();
+    pthread_sigmask (SIG_SETMASK, omask, NULL);
+}
+
+int rcmd_result (int status, int exec_err) {
+    if (!WIFEXITED(status))
+        return 0;
+    /*exec_err is only set if the child couldn't call exec*/
+    return NORMTERM | WEXITSTATUS(status) | (!exec_err ? EXECOK: 0);
+}
+
+void runcmd_attr_init (runcmd_attr_t *attr) {
+    memset (attr, 0, sizeof (runcmd_attr_t));
+    attr->nescalate = 2;
+    attr->escalate[0].signal = SIGTERM;
+    attr->escalate[0].delay = 0;
+    attr->escalate[1].signal = SIGKILL;
+    attr->escalate[1].delay = 2000;
+    attr->umask = -1;
+}
+
+int rcmd_run (const char *path, char *const argv[], int nonblock, runcmd_info_t *info, const int *io, const runcmd_attr_t *attr,
+        runcmd_done_t done, void *user_data) {
+
+    int aux = 0;
+    sigset_t omask, cmask;
+    runcmd_info_t tmp_info;
+    rcmd_proc_t proc;
+
+    rcmd_block (&omask, &cmask);
+
+    /*the child may finish before it is registered, the handler has to be there to reap it*/
+    proc.pid = -1;
+    if (nonblock && rcmd_evmode == RCMD_EV_NONE)
+        aux = rcmd_install_handler ();
+    /*other threads use the registry (and spawn) while this one spawns*/
+    if (aux == 0 && (aux = rcmd_unlock_pending ()) == 0) {
+        rcmd_start (path, argv, io, &cmask, attr, &proc);
+        rcmd_lock_pending ();
+    }
+
+    if (proc.pid < 0)
+        aux = -1;
+    else if (nonblock) {
+        /*register a callback for the child, done or else the current runcmd_onexit*/
+        aux = done ? rcmd_register_done (&proc, done, user_data) : register_child_callback (&proc);
+        rcmd_info_init (&tmp_info, &proc);
+        tmp_info.result = NONBLOCK;
+    }
+    else
+        aux = rcmd_wait_child (&proc, &tmp_info, &omask);
+    rcmd_unblock (&omask);
+    sysfail (aux<0, -1);
+
+    if (info)
+        *info = tmp_info;
+    return proc.pid;
+}
+
+int runcmd_ex (const char *command, runcmd_info_t *info, const int *io, const runcmd_attr_t *attr) {
+    char *cmd, *args[RCMD_MAXARGS];
+    int pid;
+
+    sysfail (rcmd_split (command, &cmd, args)<0, -1);
+    pid = rcmd_run (NULL, args, rcmd_nonblock (command), info, io, attr, NULL, NULL);
+    free (cmd);
+    return pid;
+}
+
+/*for runcmd_r without a callback, it mustn't fall back to runcmd_onexit*/
+static void rcmd_done_none (pid_t pid, int result, void *user_data) {
+}
+
+int runcmd_r (const char *command, int *result, const int *io, runcmd_done_t done, void *user_data) {
+    char *cmd, *args[RCMD_MAXARGS];
+    runcmd_info_t info;
+    int pid;
+
+    sysfail (rcmd_split (command, &cmd, args)<0, -1);
+    pid = rcmd_run (NULL, args, rcmd_nonblock (command), &info, io, NULL, done ? done : rcmd_done_none, user_data);
+    free (cmd);
+    if (pid >= 0 && result)
+        *result = info.result;
+    return pid;
+}
+
+int runcmd_argv (const char *const argv[], int nonblock, runcmd_info_t *info, const int *io, const runcmd_attr_t *attr) {
+    /*exec takes char *const [], the strings aren't changed*/
+    return rcmd_run (NULL, (char *const *) argv, nonblock, info, io, attr, NULL, NULL);
+}
+
+int runcmd_argv_r (const char *const argv[], int nonblock, runcmd_info_t *info, const int *io, const runcmd_attr_t *attr,
+        runcmd_done_t done, void *user_data) {
+    return rcmd_run (NULL, (char *const *) argv, nonblock, info, io, attr, done ? done : rcmd_done_none, user_data);
+}
+
+int runcmd_info (const char *command, runcmd_info_t *info, const int *io) {
+    return runcmd_ex (command, info, io, NULL);
+}
+
+/*
+if runcmd returns -1, it could be pipe error, fork error, or wait for child process error
+if *io is not NULL it should have 3 entries, otherwise we will have segmentation fault
+ */
+int runcmd (const char *command, int *result, const int *io) {
+    runcmd_info_t info;
+    pid_t pid;
 
-    if (result)
-        *result=tmp_result;
+    pid = runcmd_ex (command, &info, io, NULL);
+    if (pid >= 0 && result)
+        *result = info.result;
     return pid;
 }
 
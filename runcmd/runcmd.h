@@ -20,6 +20,16 @@
 #ifndef RUNCMD_H
 #define RUNCMD_H
 
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define RCMD_MAXARGS 1024
 #define RCMD_DELIM " \n\t\r" 
 #define RCMD_MAXARGS 1024
@@ -28,6 +38,7 @@
 #define NORMTERM (1 << 8)
 #define EXECOK (1 << 9)
 #define NONBLOCK (1 << 10)
+#define TIMEDOUT (1 << 11)
 #define RETSTATUS (0xFF)
 #define EXECFAILSTATUS 127
 
@@ -35,6 +46,67 @@
 #define IS_NONBLOCK(res) (((res) & NONBLOCK) && 1)
 #define EXITSTATUS(res) ((res) & RETSTATUS)
 #define IS_EXECOK(res) (((res) & EXECOK) && 1)
+#define IS_TIMEDOUT(res) (((res) & TIMEDOUT) && 1)
+
+/*
+    everything known about a subprocess once it has been reaped, 
+    the times are measured with CLOCK_MONOTONIC
+ */
+typedef struct {
+    pid_t pid;
+    int result; /*the same bits runcmd stores in *result*/
+    int status; /*wait status*/
+    int signal; /*signal that terminated the subprocess, 0 if it exited*/
+    int core; /*1 if it dumped core*/
+    int exec_errno; /*errno of exec in the subprocess, 0 if it succeeded*/
+    struct timeval utime, stime; /*user and system CPU time*/
+    long maxrss; /*maximum resident set size, in kilobytes*/
+    long minflt, majflt; /*page faults without and with I/O*/
+    long nvcsw, nivcsw; /*voluntary and involuntary context switches*/
+    struct timespec spawn_time; /*from the call until exec was done*/
+    struct timespec run_time; /*from exec until the subprocess was reaped*/
+} runcmd_info_t;
+
+#define RCMD_ESCALATE_MAX 4
+#define RCMD_RLIMIT_MAX 8
+#define RCMD_PASS_MAX 8
+
+/*attributes of a subprocess for runcmd_ex, see runcmd_attr_init*/
+typedef struct {
+    long timeout; /*milliseconds until the escalation starts, 0 for no timeout*/
+    int nescalate; /*entries of escalate in use*/
+    struct {
+        int signal;
+        long delay; /*milliseconds after the previous step (after the timeout for the first)*/
+    } escalate[RCMD_ESCALATE_MAX];
+    int pgroup; /*1 to run the subprocess in a process group, which gets the signals*/
+    pid_t pgid; /*with pgroup, the group to join, 0 for a new one led by the subprocess*/
+    int joinable; /*1 to keep a nonblocking subprocess until runcmd_wait_any/all collects it*/
+
+    /*applied in the subprocess right before exec, if one fails exec is reported to fail*/
+    const char *const *env; /*NULL terminated overlay of environ, "NAME=value" sets NAME and "NAME" removes it*/
+    const char *cwd; /*working directory, NULL to keep the caller's*/
+    int umask; /*file mode creation mask, -1 to keep the caller's*/
+    int nice; /*added to the nice value*/
+    int nrlimits; /*entries of rlimits in use*/
+    struct {
+        int resource; /*RLIMIT_NOFILE, RLIMIT_CPU...*/
+        struct rlimit limit;
+    } rlimits[RCMD_RLIMIT_MAX];
+    int closefds; /*1 to close every fd but 0, 1, 2 and the passed ones*/
+    int npass; /*entries of pass in use*/
+    struct {
+        int fd; /*of the caller*/
+        int target; /*the number it gets in the subprocess*/
+    } pass[RCMD_PASS_MAX];
+} runcmd_attr_t;
+
+/*spawn backends, see runcmd_spawn_backend()*/
+#define RCMD_SPAWN_AUTO 0
+#define RCMD_SPAWN_FORK 1
+#define RCMD_SPAWN_VFORK 2
+#define RCMD_SPAWN_CLONE 3
+#define RCMD_SPAWN_POSIX 4
 
 
 
@@ -46,7 +118,325 @@
 
 int runcmd(const char *command, int *result, const int *io);
 
+/*
+    like runcmd, but fills *info (if not NULL) instead of result, in nonblocking
+    mode only pid, result and spawn_time are known when it returns, the rest is 
+    given by runcmd_exit_info in runcmd_onexit
+ */
+int runcmd_info (const char *command, runcmd_info_t *info, const int *io);
+
+/*
+    no timeout, no process group and, once a timeout is set, SIGTERM when
+    it expires followed by SIGKILL 2 seconds later; the subprocess inherits
+    the environment, directory, umask, nice value and limits of the caller
+ */
+void runcmd_attr_init (runcmd_attr_t *attr);
+
+/*
+    runcmd_info with attributes (attr may be NULL), if the timeout expires 
+    the escalation signals are sent and the result has TIMEDOUT set
+ */
+int runcmd_ex (const char *command, runcmd_info_t *info, const int *io, const runcmd_attr_t *attr);
+
+/*
+    runcmd_ex with the words already split, argv is NULL terminated and is
+    run as it is (no '&' is looked for), nonblock selects the mode
+ */
+int runcmd_argv (const char *const argv[], int nonblock, runcmd_info_t *info, const int *io, const runcmd_attr_t *attr);
+
+typedef struct runcmd_cmd_t runcmd_cmd_t;
+
+/*
+    parses command and finds its executable in PATH once, so runcmd_exec 
+    can run it many times without parsing or allocating
+    returns NULL in case of error
+ */
+runcmd_cmd_t *runcmd_prepare (const char *command);
+
+/*runs a prepared command, as runcmd_ex would run the command given to runcmd_prepare*/
+int runcmd_exec (runcmd_cmd_t *cmd, runcmd_info_t *info, const int *io, const runcmd_attr_t *attr);
+
+void runcmd_cmd_free (runcmd_cmd_t *cmd);
+
+/*
+    while runcmd_onexit (or a runcmd_done_t) runs, the information of the 
+    subprocess that finished, NULL otherwise
+ */
+const runcmd_info_t *runcmd_exit_info (void);
+
+/*
+    sleeps until one of the n nonblocking subprocesses in pids finishes, or for
+    timeout milliseconds if it isn't negative; returns its pid, with its 
+    information in *info (may be NULL), 0 if the timeout expired first or -1
+    in case of error (ECHILD if none of them can be waited for).
+    a subprocess can be waited for while it runs, or once it finished if it was
+    started with attr.joinable; in both cases it is kept until collected
+ */
+pid_t runcmd_wait_any (const pid_t *pids, int n, runcmd_info_t *info, long timeout);
+
+/*
+    the same for all of them, infos (may be NULL) gets n entries in the order of 
+    pids; returns 0 once every one was collected, how many are still running if 
+    the timeout expired (none is collected then) or -1 in case of error
+ */
+int runcmd_wait_all (const pid_t *pids, int n, runcmd_info_t *infos, long timeout);
+
+/*
+    the SIGCHLD handler, installed by the first nonblocking runcmd, stays 
+    installed once the subprocesses are over; this restores the action the 
+    caller had before, returns -1 (EBUSY) if some subprocess is still running
+ */
+int runcmd_sigchld_restore (void);
+
+/*
+    selects how runcmd creates the subprocess (RCMD_SPAWN_AUTO is the default),
+    the backend is tried by creating a subprocess that exits at once; returns 
+    the backend that will be used, RCMD_SPAWN_FORK if the requested one isn't
+    available, or -1 if backend is unknown
+ */
+int runcmd_spawn_backend (int backend);
+
+/*how runcmd_capture reads the output of a subprocess, see runcmd_io_engine()*/
+#define RCMD_IO_POLL 0
+#define RCMD_IO_URING 1
+
+/*
+    selects the engine runcmd_capture uses to read the pipes of a blocking
+    subprocess and reap it (RCMD_IO_POLL is the default), returns the engine 
+    that will be used, which falls back to RCMD_IO_POLL if the kernel doesn't 
+    have io_uring, or -1 if engine is unknown
+ */
+int runcmd_io_engine (int engine);
+
+/*
+    starts the fork server, a helper process that creates the subprocesses
+    for runcmd from then on, it should be called early while the caller is 
+    still small, returns -1 in case of error
+ */
+int runcmd_forksrv_start (void);
+
+/*stops the fork server, runcmd creates the subprocesses by itself again*/
+void runcmd_forksrv_stop (void);
+
+/*
+    output of a subprocess kept in memory by runcmd_capture, 
+    data is always NUL terminated (and read only past len)
+ */
+typedef struct {
+    char *data;
+    size_t len; /*bytes in data*/
+    size_t limit; /*if not 0, at most limit bytes are kept*/
+    int truncated; /*1 if the subprocess wrote more than limit bytes*/
+
+    /*used by the library*/
+    size_t cap;
+    int fd;
+    int mapped;
+} runcmd_buf_t;
+
+/*prepares an empty buffer, limit 0 means no limit*/
+void runcmd_buf_init (runcmd_buf_t *buf, size_t limit);
+
+/*frees the data and makes buf empty again (keeping its limit)*/
+void runcmd_buf_release (runcmd_buf_t *buf);
+
+/*
+    like runcmd, but the standard output and error of the subprocess are 
+    stored in out and err (any of them may be NULL, or both the same buffer),
+    input is the standard input (no redirection if < 0)
+    in nonblocking mode the output is only available after the subprocess
+    finishes and runcmd_capture_collect is called for each buffer
+    a limit doesn't change what the subprocess sees in blocking mode (the rest
+    is read and discarded), but in nonblocking mode its writes fail with EPERM
+    about 1 MiB past the limit (see runcmd.txt)
+ */
+int runcmd_capture (const char *command, int *result, int input, runcmd_buf_t *out, runcmd_buf_t *err);
+
+/*
+    loads the output of a nonblocking runcmd_capture into buf, call it after
+    the subprocess has finished (not from signal context)
+    returns -1 in case of error
+ */
+int runcmd_capture_collect (runcmd_buf_t *buf);
+
+/*flags of runcmd_stream_new*/
+#define RCMD_STREAM_TAG (1 << 0) /*lines start with "tag: " (the pid if there's no tag)*/
+#define RCMD_STREAM_PID (1 << 1) /*lines start with "pid: "*/
+
+#define RCMD_STREAM_MAXLINE (64 * 1024) /*default for max_line*/
+#define RCMD_STREAM_PAUSE 1 /*returned by a runcmd_online_t to stop reading that child*/
+
+/*
+    called for every line a streamed subprocess writes in its standard output 
+    (fd is 1) or error (fd is 2), line includes the '\n' except for the last one
+    if it has none or for pieces of a line longer than max_line; it isn't NUL
+    terminated and only valid during the call. Returns 0 or RCMD_STREAM_PAUSE
+ */
+typedef int (*runcmd_online_t) (pid_t pid, int fd, const char *line, size_t len, void *user_data);
+
+typedef struct runcmd_stream_t runcmd_stream_t;
+
+/*
+    creates a stream, the set of pipes of the subprocesses that are added to it,
+    lines longer than max_line (0 for RCMD_STREAM_MAXLINE) are split
+    returns NULL in case of error
+ */
+runcmd_stream_t *runcmd_stream_new (int flags, size_t max_line);
+
+/*
+    runs command in nonblocking mode (as if it ended with '&'), calling online
+    for each line it writes, tag may be NULL
+    returns the pid of the subprocess or -1 in case of error
+ */
+pid_t runcmd_stream_add (runcmd_stream_t *st, const char *command, const char *tag, runcmd_online_t online, void *user_data);
+
+/*
+    waits up to timeout milliseconds (-1 forever) for output and delivers it, 
+    returns the number of subprocesses whose output isn't over yet or -1 in case of error
+ */
+int runcmd_stream_run (runcmd_stream_t *st, int timeout);
+
+/*
+    a paused subprocess isn't read, so it blocks once its pipe is full, 
+    resume delivers the buffered lines in the next runcmd_stream_run
+ */
+int runcmd_stream_pause (runcmd_stream_t *st, pid_t pid);
+int runcmd_stream_resume (runcmd_stream_t *st, pid_t pid);
+
+/*a descriptor (epoll) that is readable when runcmd_stream_run has something to do*/
+int runcmd_stream_fd (runcmd_stream_t *st);
+
+/*closes the pipes of every subprocess still in the stream and frees it*/
+void runcmd_stream_free (runcmd_stream_t *st);
+
+/*
+    called when a command of a pool (or of runcmd_r) finishes with its pid and 
+    runcmd result, or with pid -1 (and result 0) if it couldn't be started; like
+    runcmd_onexit it runs inside the SIGCHLD handler unless in event mode
+ */
+typedef void (*runcmd_done_t) (pid_t pid, int result, void *user_data);
+
+/*
+    runcmd that may be called from any number of threads at the same time: a 
+    nonblocking command calls done (may be NULL) with user_data, never the shared
+    runcmd_onexit; the threads spawn in parallel and a blocking call only sleeps
+    until its own subprocess is reaped (by whichever thread gets SIGCHLD)
+ */
+int runcmd_r (const char *command, int *result, const int *io, runcmd_done_t done, void *user_data);
+
+/*runcmd_argv that calls done (may be NULL) with user_data instead of runcmd_onexit, as runcmd_r*/
+int runcmd_argv_r (const char *const argv[], int nonblock, runcmd_info_t *info, const int *io, const runcmd_attr_t *attr,
+        runcmd_done_t done, void *user_data);
+
+typedef struct runcmd_pool_t runcmd_pool_t;
+
+/*
+    creates a pool that runs at most max commands at the same time,
+    returns NULL in case of error
+ */
+runcmd_pool_t *runcmd_pool_new (int max);
+
+/*
+    queues command (a trailing '&' is ignored) with its io (as in runcmd, may 
+    be NULL), it starts as soon as there is a free slot: a finished command 
+    hands its slot to the next one right where it is reaped
+    returns -1 in case of error
+ */
+int runcmd_pool_submit (runcmd_pool_t *pool, const char *command, const int *io, runcmd_done_t done, void *user_data);
+
+/*number of commands of the pool that are queued or running*/
+int runcmd_pool_pending (runcmd_pool_t *pool);
+
+/*blocks until every command of the pool has finished, returns -1 in case of error*/
+int runcmd_pool_wait (runcmd_pool_t *pool);
+
+/*waits for the pool and frees it*/
+void runcmd_pool_free (runcmd_pool_t *pool);
+
+/*
+    called once every stage of a nonblocking pipeline finished, with the 
+    information of each one (in order); it runs where runcmd_done_t would
+ */
+typedef void (*runcmd_pipeline_done_t) (const runcmd_info_t *infos, int n, void *user_data);
+
+/*
+    runs the n argument vectors in stages as a pipeline: the output of each stage 
+    is the input of the next one, io[0] is the input of the first stage, io[1] the
+    output of the last and io[2] the error of every stage (io may be NULL)
+    the stages are started directly (no shell) in one process group, led by the 
+    first stage, so a timeout in attr (may be NULL) signals the whole group; if
+    every stage of the group finished before the next one joined it, the next
+    one leads a new group for the rest
+    if nonblock is 0 it waits for every stage and infos (may be NULL, n of them)
+    get their information, otherwise infos get the pids, done (may be NULL) is 
+    called when all of them are over and the call returns right away
+    returns the process group id or -1 in case of error (if some stage couldn't
+    be started, the others are killed)
+ */
+pid_t runcmd_pipeline (const char *const *const stages[], int n, int nonblock, runcmd_info_t *infos, const int *io, 
+        const runcmd_attr_t *attr, runcmd_pipeline_done_t done, void *user_data);
+
+/*
+    histograms of runcmd_stats_t have one bucket per power of 2 microseconds:
+    bucket 0 counts durations under 1us and bucket i (i > 0) those in 
+    [2^(i-1), 2^i) us, the last one everything longer
+ */
+#define RCMD_STATS_BUCKETS 32
+
+typedef struct {
+    unsigned long spawns; /*subprocesses created*/
+    unsigned long exec_failures; /*of those, how many couldn't call exec*/
+    unsigned long spawn_errors; /*spawns that failed (fork, pipe, ...), no subprocess was created*/
+    unsigned long reaped;
+    unsigned long timeouts; /*subprocesses signaled because their timeout expired*/
+    long outstanding; /*nonblocking subprocesses not reaped yet*/
+    unsigned long spawn_hist[RCMD_STATS_BUCKETS]; /*from the call until exec was done*/
+    unsigned long reap_hist[RCMD_STATS_BUCKETS]; /*from the start of the reaping until the callback*/
+    unsigned long life_hist[RCMD_STATS_BUCKETS]; /*from exec until the subprocess was reaped*/
+} runcmd_stats_t;
+
+/*
+    copies the counters kept since the program started into *stats, it may be
+    called from any thread at any time (each field is read atomically, but they
+    aren't read all at the same instant)
+ */
+void runcmd_stats (runcmd_stats_t *stats);
+
+/*
+    switches to event mode and returns a file descriptor that becomes readable 
+    when a nonblocking child finishes, the caller must then call runcmd_dispatch,
+    SIGCHLD is blocked in the calling thread (it must be blocked in every thread)
+    returns -1 in case of error
+ */
+int runcmd_eventfd (void);
+
+/*
+    reaps the nonblocking children that have finished and calls their runcmd_onexit,
+    returns how many were reaped or -1 if not in event mode
+ */
+int runcmd_dispatch (void);
+
+/*
+    switches to reaper mode: a thread of the library waits for SIGCHLD and reaps,
+    runcmd_onexit and the runcmd_done_t callbacks run in that thread, one after the
+    other in the order the children were reaped, without the registry locked (so
+    they may allocate, lock, log or call runcmd); SIGCHLD is blocked in the calling
+    thread (it must be blocked in every thread), returns -1 in case of error
+ */
+int runcmd_reaper_start (void);
+
+/*
+    runs the callbacks still queued, joins the reaper thread and gives the reaping
+    back to the SIGCHLD handler, unblocking SIGCHLD in the calling thread
+    (not from a callback)
+ */
+void runcmd_reaper_stop (void);
+
 /*this function is called assyncronly when SIGCHLD is received*/
 extern void (*runcmd_onexit)(void);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,407 @@
+/*
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#ifndef RUNCMD_HPP
+#define RUNCMD_HPP
+
+#include <runcmd.h>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <initializer_list>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*runcmd is already the name of a function, so the namespace is rcmd*/
+namespace rcmd {
+
+/*what runcmd knows about a subprocess that finished*/
+struct Result {
+    runcmd_info_t info {};
+
+    pid_t pid () const noexcept { return info.pid; }
+    bool exec_ok () const noexcept { return IS_EXECOK (info.result); }
+    bool exited () const noexcept { return IS_NORMTERM (info.result); }
+    int exit_status () const noexcept { return EXITSTATUS (info.result); }
+    bool timed_out () const noexcept { return IS_TIMEDOUT (info.result); }
+    int signal () const noexcept { return info.signal; }
+    /*exec succeeded and the program exited with 0*/
+    explicit operator bool () const noexcept { return exec_ok () && exited () && exit_status () == 0; }
+};
+
+/*
+    a null terminated argv built in place, without allocating: the pointers
+    of a span of C strings are copied, string_views are copied with their NUL
+    into chars_max bytes; more than RCMD_MAXARGS words (or bytes) throw
+    std::length_error
+ */
+class Argv {
+public:
+    static constexpr std::size_t chars_max = 8192;
+
+    Argv (std::span<const char *const> words) {
+        for (const char *word : words)
+            push (word);
+    }
+    Argv (std::span<const std::string_view> words) {
+        for (std::string_view word : words)
+            push (word);
+    }
+    Argv (std::initializer_list<std::string_view> words) : Argv (std::span (words.begin (), words.size ())) {}
+
+    Argv (const Argv &) = delete;
+    Argv &operator= (const Argv &) = delete;
+
+    const char *const *get () const noexcept { return words_.data (); }
+
+private:
+    void push (const char *word) {
+        if (n_ >= RCMD_MAXARGS)
+            throw std::length_error ("rcmd::Argv: too many words");
+        words_[n_++] = word;
+        words_[n_] = nullptr;
+    }
+    void push (std::string_view word) {
+        if (word.size () >= chars_max - used_)
+            throw std::length_error ("rcmd::Argv: words too long");
+        std::memcpy (chars_.data () + used_, word.data (), word.size ());
+        chars_[used_ + word.size ()] = '\0';
+        push (chars_.data () + used_);
+        used_ += word.size () + 1;
+    }
+
+    std::array<const char *, RCMD_MAXARGS + 1> words_ {};
+    std::array<char, chars_max> chars_;
+    std::size_t n_ = 0, used_ = 0;
+};
+
+/*
+    the reaper of the subprocesses started by run and run_async: runcmd in event
+    mode (see runcmd_eventfd), so their completions are delivered by poll or run,
+    in normal context, never in the SIGCHLD handler. There is one per process,
+    created by the first get (SIGCHLD is blocked in that thread, other threads
+    that already exist must block it themselves).
+    something must drive it: start (one thread for every subprocess), run in a
+    thread of the caller, or poll from the caller's own loop when fd is readable
+ */
+class EventLoop {
+public:
+    static EventLoop &get () {
+        static EventLoop loop;
+        return loop;
+    }
+
+    EventLoop (const EventLoop &) = delete;
+    EventLoop &operator= (const EventLoop &) = delete;
+
+    /*readable when poll has something to do*/
+    int fd () const noexcept { return fd_; }
+
+    /*
+        waits up to timeout milliseconds (-1 forever), reaps the subprocesses that
+        finished and resumes the coroutines waiting for them, returns how many
+     */
+    int poll (int timeout = 0) {
+        struct pollfd pfd[2] = {{fd_, POLLIN, 0}, {wake_[0], POLLIN, 0}};
+        char buf[64];
+        int n = 0;
+
+        if (::poll (pfd, 2, timeout) < 0 && errno != EINTR)
+            throw std::system_error (errno, std::generic_category (), "poll");
+        if (pfd[1].revents)
+            while (::read (wake_[0], buf, sizeof buf) > 0)
+                ;
+        /*also reaps after a wake up, runcmd_wait_any in another thread may have taken the signal*/
+        runcmd_dispatch ();
+        for (std::coroutine_handle<> h; (h = next ()); ++n)
+            h.resume ();
+        return n;
+    }
+
+    /*poll until stop is called*/
+    void run () {
+        while (!stop_.load ())
+            poll (-1);
+        stop_.store (false);
+    }
+
+    void stop () {
+        stop_.store (true);
+        wake ();
+    }
+
+    /*runs run in a new thread, stopped and joined by the destructor*/
+    void start () {
+        sigset_t mask, omask;
+
+        std::lock_guard<std::mutex> lock (mutex_);
+        if (thread_.joinable ())
+            return ;
+        /*the thread is born with SIGCHLD blocked, runcmd_eventfd needs it*/
+        sigemptyset (&mask);
+        sigaddset (&mask, SIGCHLD);
+        pthread_sigmask (SIG_BLOCK, &mask, &omask);
+        thread_ = std::thread ([this] { run (); });
+        pthread_sigmask (SIG_SETMASK, &omask, nullptr);
+    }
+
+    /*h is resumed by the next poll, from any thread*/
+    void defer (std::coroutine_handle<> h) {
+        {
+            std::lock_guard<std::mutex> lock (mutex_);
+            ready_.push_back (h);
+        }
+        wake ();
+    }
+
+private:
+    EventLoop () {
+        fd_ = runcmd_eventfd ();
+        if (fd_ < 0 || ::pipe (wake_) < 0)
+            throw std::system_error (errno, std::generic_category (), "rcmd::EventLoop");
+        for (int fd : wake_) {
+            ::fcntl (fd, F_SETFD, FD_CLOEXEC);
+            ::fcntl (fd, F_SETFL, O_NONBLOCK);
+        }
+    }
+
+    ~EventLoop () {
+        if (thread_.joinable ()) {
+            stop ();
+            thread_.join ();
+        }
+        ::close (wake_[0]);
+        ::close (wake_[1]);
+    }
+
+    void wake () noexcept {
+        char c = 0;
+        (void) !::write (wake_[1], &c, 1);
+    }
+
+    std::coroutine_handle<> next () {
+        std::lock_guard<std::mutex> lock (mutex_);
+        std::coroutine_handle<> h;
+
+        if (!ready_.empty ()) {
+            h = ready_.front ();
+            ready_.pop_front ();
+        }
+        return h;
+    }
+
+    int fd_ = -1, wake_[2] = {-1, -1};
+    std::atomic<bool> stop_ {false};
+    std::mutex mutex_;
+    std::deque<std::coroutine_handle<>> ready_;
+    std::thread thread_;
+};
+
+namespace detail {
+
+/*the information of the subprocess whose done callback is running*/
+inline Result exit_result (pid_t pid, int result) {
+    Result res;
+    const runcmd_info_t *info = runcmd_exit_info ();
+
+    if (info != nullptr)
+        res.info = *info;
+    res.info.pid = pid;
+    res.info.result = result;
+    return res;
+}
+
+}
+
+/*
+    a running subprocess that is waited for when the handle is destroyed (or
+    moved over), like std::jthread; it is started joinable, so wait works
+    whenever it is called, in signal or event mode
+ */
+class Child {
+public:
+    Child () noexcept = default;
+
+    /*runs argv in nonblocking mode, attr and io as in runcmd_argv; throws std::system_error*/
+    explicit Child (const Argv &argv, const int *io = nullptr, const runcmd_attr_t *attr = nullptr) {
+        runcmd_attr_t a;
+
+        if (attr != nullptr)
+            a = *attr;
+        else
+            runcmd_attr_init (&a);
+        a.joinable = 1;
+        pid_ = runcmd_argv (argv.get (), 1, nullptr, io, &a);
+        if (pid_ < 0)
+            throw std::system_error (errno, std::generic_category (), "runcmd_argv");
+    }
+
+    Child (Child &&other) noexcept : pid_ (std::exchange (other.pid_, -1)) {}
+
+    Child &operator= (Child &&other) noexcept {
+        if (this != &other) {
+            reap ();
+            pid_ = std::exchange (other.pid_, -1);
+        }
+        return *this;
+    }
+
+    ~Child () { reap (); }
+
+    pid_t pid () const noexcept { return pid_; }
+    bool running () const noexcept { return pid_ > 0; }
+
+    /*sleeps until it finishes, throws std::system_error*/
+    Result wait () {
+        Result res;
+
+        if (runcmd_wait_any (&pid_, 1, &res.info, -1) != pid_)
+            throw std::system_error (errno, std::generic_category (), "runcmd_wait_any");
+        pid_ = -1;
+        return res;
+    }
+
+    /*the result if it finished within timeout*/
+    std::optional<Result> wait_for (std::chrono::milliseconds timeout) {
+        Result res;
+        pid_t pid = runcmd_wait_any (&pid_, 1, &res.info, (long) timeout.count ());
+
+        if (pid < 0)
+            throw std::system_error (errno, std::generic_category (), "runcmd_wait_any");
+        if (pid == 0)
+            return std::nullopt;
+        pid_ = -1;
+        return res;
+    }
+
+    /*sends sig, the subprocess must still be waited for*/
+    bool kill (int sig = SIGTERM) noexcept { return pid_ > 0 && ::kill (pid_, sig) == 0; }
+
+private:
+    void reap () noexcept {
+        runcmd_info_t info;
+
+        if (pid_ > 0)
+            runcmd_wait_any (&pid_, 1, &info, -1);
+        pid_ = -1;
+    }
+
+    pid_t pid_ = -1;
+};
+
+/*
+    co_await run (std::array<std::string_view, 2> {"ls", "-l"}) runs argv in
+    nonblocking mode and suspends the coroutine until it finishes, it is resumed
+    by EventLoop::poll; argv is read when the coroutine suspends, so the words
+    must live until the co_await does (temporaries of the co_await expression
+    do, but g++ 12 rejects a braced list there). A subprocess that can't be
+    started throws std::system_error
+ */
+class RunAwaiter {
+public:
+    RunAwaiter (std::span<const char *const> argv, const int *io, const runcmd_attr_t *attr) noexcept
+        : cwords_ (argv), io_ (io), attr_ (attr) {}
+    RunAwaiter (std::span<const std::string_view> argv, const int *io, const runcmd_attr_t *attr) noexcept
+        : words_ (argv), io_ (io), attr_ (attr) {}
+
+    bool await_ready () const noexcept { return false; }
+
+    bool await_suspend (std::coroutine_handle<> h) {
+        Argv argv = cwords_.empty () ? Argv (words_) : Argv (cwords_);
+
+        handle_ = h;
+        EventLoop::get ();
+        /*this may be resumed (and gone) as soon as it is started, it isn't touched afterwards*/
+        if (runcmd_argv_r (argv.get (), 1, nullptr, io_, attr_, done, this) < 0) {
+            err_ = errno;
+            return false;
+        }
+        return true;
+    }
+
+    Result await_resume () {
+        if (err_ != 0)
+            throw std::system_error (err_, std::generic_category (), "runcmd_argv_r");
+        return result_;
+    }
+
+private:
+    static void done (pid_t pid, int result, void *ptr) {
+        RunAwaiter *self = static_cast<RunAwaiter *> (ptr);
+
+        self->result_ = detail::exit_result (pid, result);
+        EventLoop::get ().defer (self->handle_);
+    }
+
+    std::span<const char *const> cwords_;
+    std::span<const std::string_view> words_;
+    const int *io_;
+    const runcmd_attr_t *attr_;
+    std::coroutine_handle<> handle_;
+    Result result_;
+    int err_ = 0;
+};
+
+inline RunAwaiter run (std::span<const char *const> argv, const int *io = nullptr, const runcmd_attr_t *attr = nullptr) {
+    return RunAwaiter (argv, io, attr);
+}
+
+inline RunAwaiter run (std::span<const std::string_view> argv, const int *io = nullptr, const runcmd_attr_t *attr = nullptr) {
+    return RunAwaiter (argv, io, attr);
+}
+
+/*
+    runs argv in nonblocking mode, the future is ready once EventLoop::poll
+    reaped it (get in the thread that polls would never return);
+    a subprocess that can't be started throws std::system_error
+ */
+inline std::future<Result> run_async (const Argv &argv, const int *io = nullptr, const runcmd_attr_t *attr = nullptr) {
+    auto promise = std::make_unique<std::promise<Result>> ();
+    std::future<Result> future = promise->get_future ();
+
+    EventLoop::get ();
+    /*the callback owns the promise from now on*/
+    if (runcmd_argv_r (argv.get (), 1, nullptr, io, attr, [] (pid_t pid, int result, void *ptr) {
+                std::unique_ptr<std::promise<Result>> promise (static_cast<std::promise<Result> *> (ptr));
+                promise->set_value (detail::exit_result (pid, result));
+            }, promise.get ()) < 0)
+        throw std::system_error (errno, std::generic_category (), "runcmd_argv_r");
+    promise.release ();
+    return future;
+}
+
+}
+
+#endif
@@ -0,0 +1,97 @@
+/*  stats.c - runcmd_stats, counters and histograms kept by libruncmd
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include <string.h>
+#include <time.h>
+#include <runcmd.h>
+#include "internal.h"
+
+/*
+   updated from the SIGCHLD handler and from any thread, so every change is one
+   atomic add (lock free, hence async-signal-safe) and readers never lock either
+ */
+#define RCMD_ADD(var, n) ((void) __sync_fetch_and_add (&(var), (n)))
+#define RCMD_GET(var) __sync_fetch_and_add (&(var), 0)
+
+static runcmd_stats_t rcmd_stats;
+
+/*bucket of a duration, see RCMD_STATS_BUCKETS*/
+static int rcmd_bucket (const struct timespec *ts) {
+    unsigned long us;
+    int i = 0;
+
+    if (ts->tv_sec < 0)
+        return 0;
+    /*past ~35 minutes it is just the last bucket*/
+    us = ts->tv_sec > 2000 ? ~0UL : (unsigned long) ts->tv_sec * 1000000UL + ts->tv_nsec / 1000;
+    while (us > 0 && i < RCMD_STATS_BUCKETS - 1) {
+        us >>= 1;
+        ++i;
+    }
+    return i;
+}
+
+void rcmd_stats_spawn (const rcmd_proc_t *proc) {
+    struct timespec ts;
+
+    if (proc->pid < 0) {
+        RCMD_ADD (rcmd_stats.spawn_errors, 1);
+        return ;
+    }
+    RCMD_ADD (rcmd_stats.spawns, 1);
+    if (proc->exec_err)
+        RCMD_ADD (rcmd_stats.exec_failures, 1);
+
+    ts.tv_sec = proc->exec.tv_sec - proc->start.tv_sec;
+    ts.tv_nsec = proc->exec.tv_nsec - proc->start.tv_nsec;
+    if (ts.tv_nsec < 0) {
+        ts.tv_nsec += 1000000000L;
+        --ts.tv_sec;
+    }
+    RCMD_ADD (rcmd_stats.spawn_hist[rcmd_bucket (&ts)], 1);
+}
+
+void rcmd_stats_outstanding (int n) {
+    RCMD_ADD (rcmd_stats.outstanding, n);
+}
+
+void rcmd_stats_exit (const runcmd_info_t *info, const struct timespec *latency) {
+    RCMD_ADD (rcmd_stats.reaped, 1);
+    if (IS_TIMEDOUT (info->result))
+        RCMD_ADD (rcmd_stats.timeouts, 1);
+    RCMD_ADD (rcmd_stats.life_hist[rcmd_bucket (&info->run_time)], 1);
+    if (latency != NULL)
+        RCMD_ADD (rcmd_stats.reap_hist[rcmd_bucket (latency)], 1);
+}
+
+void runcmd_stats (runcmd_stats_t *stats) {
+    int i;
+
+    stats->spawns = RCMD_GET (rcmd_stats.spawns);
+    stats->exec_failures = RCMD_GET (rcmd_stats.exec_failures);
+    stats->spawn_errors = RCMD_GET (rcmd_stats.spawn_errors);
+    stats->reaped = RCMD_GET (rcmd_stats.reaped);
+    stats->timeouts = RCMD_GET (rcmd_stats.timeouts);
+    stats->outstanding = RCMD_GET (rcmd_stats.outstanding);
+    for (i = 0; i < RCMD_STATS_BUCKETS; ++i) {
+        stats->spawn_hist[i] = RCMD_GET (rcmd_stats.spawn_hist[i]);
+        stats->reap_hist[i] = RCMD_GET (rcmd_stats.reap_hist[i]);
+        stats->life_hist[i] = RCMD_GET (rcmd_stats.life_hist[i]);
+    }
+}
@@ -0,0 +1,455 @@
+/*  stream.c - runcmd_stream, live line output of many nonblocking subprocesses
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#include <runcmd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include "debug.h"
+#include "internal.h"
+
+#define RCMD_LINE_MIN 4096 /*first allocation of a line buffer*/
+#define RCMD_STREAM_EVENTS 64 /*events taken by one epoll_wait*/
+
+struct rcmd_schild_t;
+
+/*one of the two pipes of a child (stdout or stderr)*/
+typedef struct {
+    struct rcmd_schild_t *child;
+    int fd; /*read end, -1 after the end of file*/
+    int stdfd; /*STDOUT_FILENO or STDERR_FILENO*/
+    char *buf; /*bytes read that weren't delivered yet*/
+    size_t len, cap;
+} rcmd_spipe_t;
+
+typedef struct rcmd_schild_t {
+    pid_t pid;
+    char *tag;
+    runcmd_online_t online;
+    void *user_data;
+    rcmd_spipe_t pipes[2];
+    int paused; /*the consumer asked us to stop reading*/
+    int ready; /*resumed with lines still buffered, see runcmd_stream_run*/
+    int done; /*every pipe closed and delivered, freed at the end of runcmd_stream_run*/
+    struct rcmd_schild_t *next, *prev;
+} rcmd_schild_t;
+
+struct runcmd_stream_t {
+    int epfd;
+    int flags;
+    size_t max_line;
+    int nopen; /*children with at least one pipe open*/
+    rcmd_schild_t *children;
+    char *scratch; /*a line with its prefix*/
+    size_t scratch_cap;
+};
+
+runcmd_stream_t *runcmd_stream_new (int flags, size_t max_line) {
+#ifdef __linux__
+    runcmd_stream_t *st = malloc (sizeof (runcmd_stream_t));
+    sysfail (st == NULL, NULL);
+
+    st->epfd = epoll_create1 (EPOLL_CLOEXEC);
+    if (st->epfd < 0) {
+        free (st);
+        return NULL;
+    }
+    st->flags = flags;
+    st->max_line = max_line ? max_line : RCMD_STREAM_MAXLINE;
+    st->nopen = 0;
+    st->children = NULL;
+    st->scratch = NULL;
+    st->scratch_cap = 0;
+    return st;
+#else
+    errno = ENOSYS;
+    return NULL;
+#endif
+}
+
+int runcmd_stream_fd (runcmd_stream_t *st) {
+    return st->epfd;
+}
+
+static void rcmd_schild_free (runcmd_stream_t *st, rcmd_schild_t *child) {
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        if (child->pipes[i].fd >= 0) {
+#ifdef __linux__
+            /*close doesn't take it out while a forked child still has the pipe*/
+            epoll_ctl (st->epfd, EPOLL_CTL_DEL, child->pipes[i].fd, NULL);
+#endif
+            close (child->pipes[i].fd);
+        }
+        free (child->pipes[i].buf);
+    }
+    if (child->prev)
+        child->prev->next = child->next;
+    else
+        st->children = child->next;
+    if (child->next)
+        child->next->prev = child->prev;
+    free (child->tag);
+    free (child);
+}
+
+void runcmd_stream_free (runcmd_stream_t *st) {
+    if (st == NULL)
+        return ;
+    while (st->children != NULL)
+        rcmd_schild_free (st, st->children);
+    close (st->epfd);
+    free (st->scratch);
+    free (st);
+}
+
+#ifdef __linux__
+
+/*
+   adds (or removes, op is EPOLL_CTL_DEL) the open pipes of child to the epoll set,
+   a paused child is out of it, otherwise a hang up would wake us up again and again
+ */
+static int rcmd_schild_watch (runcmd_stream_t *st, rcmd_schild_t *child, int op) {
+    struct epoll_event ev;
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        if (child->pipes[i].fd < 0)
+            continue;
+        ev.events = EPOLLIN;
+        ev.data.ptr = &child->pipes[i];
+        sysfail (epoll_ctl (st->epfd, op, child->pipes[i].fd, &ev) < 0, -1);
+    }
+    return 0;
+}
+
+/*
+   calls online for line, with the prefix asked in runcmd_stream_new
+   returns what online returned
+ */
+static int rcmd_deliver (runcmd_stream_t *st, rcmd_spipe_t *pipe, const char *line, size_t len) {
+    rcmd_schild_t *child = pipe->child;
+    char prefix[64];
+    const char *tag = NULL;
+    size_t plen = 0, tlen = 0;
+
+    if ((st->flags & RCMD_STREAM_TAG) && child->tag != NULL)
+        tag = child->tag;
+    else if (st->flags & (RCMD_STREAM_TAG | RCMD_STREAM_PID)) {
+        sprintf (prefix, "%ld", (long) child->pid);
+        tag = prefix;
+    }
+
+    if (tag != NULL) {
+        tlen = strlen (tag);
+        plen = tlen + 2;
+        if (st->scratch_cap < plen + len) {
+            char *nscratch = realloc (st->scratch, plen + len);
+            sysfail (nscratch == NULL, -1);
+            st->scratch = nscratch;
+            st->scratch_cap = plen + len;
+        }
+        memcpy (st->scratch, tag, tlen);
+        memcpy (st->scratch + tlen, ": ", 2);
+        memcpy (st->scratch + plen, line, len);
+        line = st->scratch;
+    }
+    return child->online (child->pid, pipe->stdfd, line, plen + len, child->user_data) == RCMD_STREAM_PAUSE ? RCMD_STREAM_PAUSE : 0;
+}
+
+/*
+   delivers the complete lines in pipe->buf (all of it at the end of file),
+   stops early if the consumer pauses the child
+   returns -1 in case of error, the line that wasn't delivered stays in pipe->buf
+ */
+static int rcmd_deliver_lines (runcmd_stream_t *st, rcmd_spipe_t *pipe, int eof) {
+    char *beg = pipe->buf, *end = pipe->buf + pipe->len, *nl;
+    int ret = 0, aux;
+
+    while (beg < end && !pipe->child->paused) {
+        nl = memchr (beg, '\n', end - beg);
+        if (nl == NULL) {
+            /*a line longer than max_line is delivered in pieces*/
+            if (!eof && (size_t)(end - beg) < st->max_line)
+                break;
+            nl = end - 1;
+        }
+        aux = rcmd_deliver (st, pipe, beg, nl - beg + 1);
+        if (aux < 0) {
+            ret = -1;
+            break;
+        }
+        if (aux == RCMD_STREAM_PAUSE && !pipe->child->paused) {
+            pipe->child->paused = 1;
+            rcmd_schild_watch (st, pipe->child, EPOLL_CTL_DEL);
+        }
+        beg = nl + 1;
+    }
+
+    pipe->len = end - beg;
+    if (pipe->len && beg != pipe->buf)
+        memmove (pipe->buf, beg, pipe->len);
+    return ret;
+}
+
+/*closes a pipe that reached the end of file, returns 1 if the child has no pipe left*/
+static int rcmd_spipe_close (runcmd_stream_t *st, rcmd_spipe_t *pipe) {
+    rcmd_schild_t *child = pipe->child;
+
+    /*
+       close alone isn't enough, a child forked meanwhile may hold the read end
+       until it execs and the pipe would stay in the set (a paused child isn't there)
+     */
+    if (!child->paused)
+        epoll_ctl (st->epfd, EPOLL_CTL_DEL, pipe->fd, NULL);
+    close (pipe->fd);
+    pipe->fd = -1;
+    if (child->pipes[0].fd >= 0 || child->pipes[1].fd >= 0)
+        return 0;
+    --st->nopen;
+    return 1;
+}
+
+/*
+   reads what is available in pipe, delivering each complete line
+   returns -1 in case of error
+ */
+static int rcmd_spipe_read (runcmd_stream_t *st, rcmd_spipe_t *pipe) {
+    ssize_t n;
+
+    while (!pipe->child->paused) {
+        if (pipe->cap - pipe->len == 0) {
+            size_t ncap = pipe->cap ? pipe->cap * 2 : RCMD_LINE_MIN;
+            char *nbuf;
+            if (ncap > st->max_line)
+                ncap = st->max_line;
+            nbuf = realloc (pipe->buf, ncap);
+            sysfail (nbuf == NULL, -1);
+            pipe->buf = nbuf;
+            pipe->cap = ncap;
+        }
+        /*still full after a delivery failed, reading 0 bytes would look like the end of file*/
+        if (pipe->len == pipe->cap) {
+            sysfail (rcmd_deliver_lines (st, pipe, 0) < 0, -1);
+            continue;
+        }
+        n = read (pipe->fd, pipe->buf + pipe->len, pipe->cap - pipe->len);
+        if (n < 0)
+            return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+        if (n == 0) {
+            /*the pipe stays open, so the end of file comes again in the next run*/
+            sysfail (rcmd_deliver_lines (st, pipe, 1) < 0, -1);
+            /*the rest is delivered when the consumer resumes*/
+            /*other events of this epoll_wait may point to the child, it is freed after them*/
+            if (pipe->len == 0 && rcmd_spipe_close (st, pipe) && !pipe->child->paused)
+                pipe->child->done = 1;
+            return 0;
+        }
+        pipe->len += n;
+        sysfail (rcmd_deliver_lines (st, pipe, 0) < 0, -1);
+    }
+    return 0;
+}
+
+pid_t runcmd_stream_add (runcmd_stream_t *st, const char *command, const char *tag, runcmd_online_t online, void *user_data) {
+    int i, err, pipefd[2][2], io[3] = {-1, -1, -1};
+    char *cmd, *args[RCMD_MAXARGS];
+    sigset_t omask, cmask;
+    rcmd_schild_t *child;
+    rcmd_proc_t proc;
+    pid_t pid;
+
+    child = calloc (1, sizeof (rcmd_schild_t));
+    sysfail (child == NULL, -1);
+    child->online = online;
+    child->user_data = user_data;
+    if (tag != NULL) {
+        child->tag = malloc (strlen (tag) + 1);
+        if (child->tag == NULL) {
+            free (child);
+            return -1;
+        }
+        strcpy (child->tag, tag);
+    }
+
+    for (i = 0; i < 2; ++i) {
+        if (rcmd_pipe (pipefd[i], 1) < 0) {
+            if (i == 1) {
+                close (pipefd[0][0]);
+                close (pipefd[0][1]);
+            }
+            free (child->tag);
+            free (child);
+            return -1;
+        }
+        child->pipes[i].child = child;
+        child->pipes[i].fd = pipefd[i][0];
+        child->pipes[i].stdfd = i + 1;
+        io[i + 1] = pipefd[i][1];
+    }
+    child->next = st->children;
+    if (st->children)
+        st->children->prev = child;
+    st->children = child;
+
+    if (rcmd_split (command, &cmd, args) < 0)
+        pid = -1;
+    else {
+        rcmd_block (&omask, &cmask);
+        /*other threads use the registry (and spawn) while this one spawns, as in rcmd_run*/
+        pid = proc.pid = -1;
+        if (rcmd_unlock_pending () == 0) {
+            pid = rcmd_start (NULL, args, io, &cmask, NULL, &proc);
+            rcmd_lock_pending ();
+        }
+        free (cmd);
+        /*always nonblocking, the child is reaped as any '&' command*/
+        if (pid > 0 && register_child_callback (&proc) < 0) {
+            /*nobody would call its callback and the caller doesn't get its pid*/
+            err = errno;
+            kill (pid, SIGKILL);
+            while (waitpid (pid, NULL, 0) < 0 && errno == EINTR)
+                ;
+            errno = err;
+            pid = -1;
+        }
+        rcmd_unblock (&omask);
+    }
+
+    close (pipefd[0][1]);
+    close (pipefd[1][1]);
+    child->pid = pid;
+
+    if (pid < 0 || rcmd_schild_watch (st, child, EPOLL_CTL_ADD) < 0) {
+        rcmd_schild_free (st, child);
+        return -1;
+    }
+    ++st->nopen;
+    return pid;
+}
+
+static rcmd_schild_t *rcmd_stream_find (runcmd_stream_t *st, pid_t pid) {
+    rcmd_schild_t *child;
+    for (child = st->children; child != NULL; child = child->next)
+        if (child->pid == pid)
+            return child;
+    return NULL;
+}
+
+int runcmd_stream_pause (runcmd_stream_t *st, pid_t pid) {
+    rcmd_schild_t *child = rcmd_stream_find (st, pid);
+
+    sysfail (child == NULL, -1);
+    if (child->paused)
+        return 0;
+    child->paused = 1;
+    return rcmd_schild_watch (st, child, EPOLL_CTL_DEL);
+}
+
+int runcmd_stream_resume (runcmd_stream_t *st, pid_t pid) {
+    rcmd_schild_t *child = rcmd_stream_find (st, pid);
+
+    sysfail (child == NULL, -1);
+    if (!child->paused)
+        return 0;
+    child->paused = 0;
+    /*the lines already buffered go first*/
+    child->ready = 1;
+    return rcmd_schild_watch (st, child, EPOLL_CTL_ADD);
+}
+
+int runcmd_stream_run (runcmd_stream_t *st, int timeout) {
+    struct epoll_event evs[RCMD_STREAM_EVENTS];
+    rcmd_schild_t *child, *next;
+    rcmd_spipe_t *pipe;
+    int i, j, n;
+
+    for (child = st->children; child != NULL; child = next) {
+        next = child->next;
+        if (!child->ready)
+            continue;
+        child->ready = 0;
+        for (j = 0; j < 2; ++j) {
+            pipe = &child->pipes[j];
+            if (rcmd_deliver_lines (st, pipe, pipe->fd < 0) < 0) {
+                /*tried again in the next run*/
+                child->ready = 1;
+                return -1;
+            }
+        }
+        if (child->pipes[0].fd < 0 && child->pipes[1].fd < 0 && !child->paused)
+            rcmd_schild_free (st, child);
+        timeout = 0;
+    }
+
+    if (st->nopen == 0)
+        return 0;
+
+    n = epoll_wait (st->epfd, evs, RCMD_STREAM_EVENTS, timeout);
+    if (n < 0 && errno == EINTR)
+        n = 0;
+    sysfail (n < 0, -1);
+
+    for (i = 0; i < n; ++i) {
+        pipe = evs[i].data.ptr;
+        if (pipe->fd >= 0 && rcmd_spipe_read (st, pipe) < 0)
+            break;
+    }
+
+    for (child = st->children; child != NULL; child = next) {
+        next = child->next;
+        if (child->done)
+            rcmd_schild_free (st, child);
+    }
+    sysfail (i < n, -1);
+    return st->nopen;
+}
+
+#else
+
+pid_t runcmd_stream_add (runcmd_stream_t *st, const char *command, const char *tag, runcmd_online_t online, void *user_data) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int runcmd_stream_pause (runcmd_stream_t *st, pid_t pid) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int runcmd_stream_resume (runcmd_stream_t *st, pid_t pid) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int runcmd_stream_run (runcmd_stream_t *st, int timeout) {
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*  test_pipeline.c - runs pipelines whose first stage exits right away, while
+    another reaper (the reaper thread, then the fork server) reaps it, and
+    checks that every later stage still runs
+
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+#include <runcmd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RUNS 200
+
+/*runs 'true | sleep 0.05 | true' RUNS times, returns the number of bad stages*/
+static int run (const char *name) {
+    static const char *const first[] = {"true", NULL};
+    static const char *const second[] = {"sleep", "0.05", NULL};
+    const char *const *const stages[] = {first, second, first};
+    runcmd_info_t infos[3];
+    int i, j, bad = 0;
+
+    for (i = 0; i < RUNS; ++i) {
+        if (runcmd_pipeline (stages, 3, 0, infos, NULL, NULL, NULL, NULL) < 0) {
+            printf ("%s: run %d: runcmd_pipeline failed\n", name, i);
+            ++bad;
+            continue;
+        }
+        for (j = 0; j < 3; ++j) {
+            if (!IS_EXECOK (infos[j].result) || !IS_NORMTERM (infos[j].result) || EXITSTATUS (infos[j].result) != 0) {
+                printf ("%s: run %d: stage %d: result %d, exec_errno %d (%s)\n", name, i, j + 1,
+                        infos[j].result, infos[j].exec_errno, strerror (infos[j].exec_errno));
+                ++bad;
+            }
+        }
+    }
+    printf ("%s: %d bad stages in %d runs\n", name, bad, RUNS);
+    return bad;
+}
+
+int main (void) {
+    int bad = 0;
+
+    if (runcmd_reaper_start () < 0) {
+        perror ("runcmd_reaper_start");
+        return EXIT_FAILURE;
+    }
+    bad += run ("reaper");
+    runcmd_reaper_stop ();
+
+    if (runcmd_forksrv_start () < 0) {
+        perror ("runcmd_forksrv_start");
+        return EXIT_FAILURE;
+    }
+    bad += run ("forksrv");
+    runcmd_forksrv_stop ();
+
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,319 @@
+/*  uring.c - the io_uring engine, raw system calls without liburing
+    Copyright (c) Danilo Tedeschi 2016  <danfyty@gmail.com>
+
+    This file is part of Jucilei.
+
+    jucilei is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    jucilei is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with jucilei.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+#define _GNU_SOURCE /*syscall and SPLICE_F_MOVE*/
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <runcmd.h>
+#include "debug.h"
+#include "internal.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(SYS_io_uring_setup)
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+
+#define RCMD_RING_ENTRIES 8 /*submission queue entries of a ring*/
+
+/*IORING_OP_WAITID (Linux 6.7), older headers don't have it*/
+#define RCMD_OP_WAITID 50
+
+static int rcmd_io_engine = RCMD_IO_POLL;
+
+/*what the probe found, see runcmd_io_engine*/
+static int rcmd_ring_ok = 0, rcmd_ring_waitid_ok = 0;
+
+struct rcmd_ring_t {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *rings, *sqe_map;
+    size_t rings_len, sqe_len;
+    unsigned entries, queued, pending; /*queued aren't in the tail yet, pending weren't submitted*/
+    int broken; /*io_uring_enter failed, requests may still be running*/
+    struct rcmd_ring_t *next; /*in rcmd_rings*/
+};
+
+/*rings nobody is using*/
+static rcmd_ring_t *rcmd_rings = NULL;
+static pthread_mutex_t rcmd_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void rcmd_ring_free (rcmd_ring_t *ring) {
+    if (ring->sqe_map != NULL)
+        munmap (ring->sqe_map, ring->sqe_len);
+    if (ring->rings != NULL)
+        munmap (ring->rings, ring->rings_len);
+    close (ring->fd);
+    free (ring);
+}
+
+/*a new ring, NULL if io_uring can't be used (old kernel, seccomp...)*/
+static rcmd_ring_t *rcmd_ring_new (void) {
+    struct io_uring_params p;
+    rcmd_ring_t *ring;
+    size_t sq_len, cq_len;
+    char *sq, *cq;
+
+    ring = calloc (1, sizeof (rcmd_ring_t));
+    sysfail (ring == NULL, NULL);
+    memset (&p, 0, sizeof p);
+    ring->fd = syscall (SYS_io_uring_setup, RCMD_RING_ENTRIES, &p);
+    if (ring->fd < 0) {
+        free (ring);
+        return NULL;
+    }
+    fcntl (ring->fd, F_SETFD, FD_CLOEXEC);
+
+    /*both queues in one mapping, every kernel with waitid does it*/
+    sq_len = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    ring->rings_len = sq_len > cq_len ? sq_len : cq_len;
+    ring->sqe_len = p.sq_entries * sizeof (struct io_uring_sqe);
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        rcmd_ring_free (ring);
+        return NULL;
+    }
+    ring->rings = mmap (NULL, ring->rings_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->sqe_map = mmap (NULL, ring->sqe_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->rings == MAP_FAILED || ring->sqe_map == MAP_FAILED) {
+        if (ring->rings == MAP_FAILED)
+            ring->rings = NULL;
+        if (ring->sqe_map == MAP_FAILED)
+            ring->sqe_map = NULL;
+        rcmd_ring_free (ring);
+        return NULL;
+    }
+
+    sq = cq = ring->rings;
+    ring->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + p.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+    ring->sqes = ring->sqe_map;
+    ring->entries = p.sq_entries;
+    return ring;
+}
+
+/*1 if the kernel knows op*/
+static int rcmd_ring_probe (const struct io_uring_probe *probe, int op) {
+    return op <= probe->last_op && op < probe->ops_len && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+}
+
+int runcmd_io_engine (int engine) {
+    struct io_uring_probe *probe;
+    rcmd_ring_t *ring;
+    size_t size;
+
+    if (engine == RCMD_IO_POLL) {
+        rcmd_io_engine = engine;
+        return engine;
+    }
+    if (engine != RCMD_IO_URING)
+        return -1;
+
+    pthread_mutex_lock (&rcmd_rings_mutex);
+    if (!rcmd_ring_ok && (ring = rcmd_ring_new ()) != NULL) {
+        size = sizeof (struct io_uring_probe) + 256 * sizeof (struct io_uring_probe_op);
+        probe = calloc (1, size);
+        if (probe != NULL && syscall (SYS_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+            rcmd_ring_ok = rcmd_ring_probe (probe, IORING_OP_READ) && rcmd_ring_probe (probe, IORING_OP_SPLICE);
+            rcmd_ring_waitid_ok = rcmd_ring_probe (probe, RCMD_OP_WAITID);
+        }
+        free (probe);
+        /*the first one is kept for runcmd_capture*/
+        if (rcmd_ring_ok) {
+            ring->next = rcmd_rings;
+            rcmd_rings = ring;
+        }
+        else
+            rcmd_ring_free (ring);
+    }
+    rcmd_io_engine = rcmd_ring_ok ? RCMD_IO_URING : RCMD_IO_POLL;
+    pthread_mutex_unlock (&rcmd_rings_mutex);
+    return rcmd_io_engine;
+}
+
+rcmd_ring_t *rcmd_ring_get (void) {
+    rcmd_ring_t *ring;
+
+    if (rcmd_io_engine != RCMD_IO_URING)
+        return NULL;
+    pthread_mutex_lock (&rcmd_rings_mutex);
+    ring = rcmd_rings;
+    if (ring != NULL)
+        rcmd_rings = ring->next;
+    pthread_mutex_unlock (&rcmd_rings_mutex);
+    return ring != NULL ? ring : rcmd_ring_new ();
+}
+
+void rcmd_ring_put (rcmd_ring_t *ring) {
+    /*a ring given up in the middle of a request can't be used again*/
+    if (ring->broken || ring->queued + ring->pending > 0 || *ring->cq_head != *ring->cq_tail) {
+        rcmd_ring_free (ring);
+        return ;
+    }
+    pthread_mutex_lock (&rcmd_rings_mutex);
+    ring->next = rcmd_rings;
+    rcmd_rings = ring;
+    pthread_mutex_unlock (&rcmd_rings_mutex);
+}
+
+/*
+   the next free entry, NULL if the ring is full; it is seen by the kernel
+   once the caller is done with it, when rcmd_ring_next publishes the tail
+ */
+static struct io_uring_sqe *rcmd_ring_sqe (rcmd_ring_t *ring, int op, int fd, long tag) {
+    struct io_uring_sqe *sqe;
+    unsigned tail = *ring->sq_tail + ring->queued;
+
+    if (ring->queued + ring->pending >= ring->entries)
+        return NULL;
+    sqe = &ring->sqes[tail & *ring->sq_mask];
+    memset (sqe, 0, sizeof (struct io_uring_sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->user_data = tag;
+    ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+    ++ring->queued;
+    return sqe;
+}
+
+int rcmd_ring_read (rcmd_ring_t *ring, int fd, void *buf, size_t len, long tag) {
+    struct io_uring_sqe *sqe = rcmd_ring_sqe (ring, IORING_OP_READ, fd, tag);
+
+    if (sqe == NULL)
+        return -1;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    /*pipes have no offset*/
+    sqe->off = ~(__u64) 0;
+    return 0;
+}
+
+int rcmd_ring_splice (rcmd_ring_t *ring, int fd_in, int fd_out, size_t len, long tag) {
+    struct io_uring_sqe *sqe = rcmd_ring_sqe (ring, IORING_OP_SPLICE, fd_out, tag);
+
+    if (sqe == NULL)
+        return -1;
+    sqe->splice_fd_in = fd_in;
+    sqe->splice_off_in = ~(__u64) 0;
+    sqe->off = ~(__u64) 0;
+    sqe->len = len;
+    sqe->splice_flags = SPLICE_F_MOVE;
+    return 0;
+}
+
+int rcmd_ring_waitid (rcmd_ring_t *ring, pid_t pid, siginfo_t *si, long tag) {
+    struct io_uring_sqe *sqe;
+
+    if (!rcmd_ring_waitid_ok || (sqe = rcmd_ring_sqe (ring, RCMD_OP_WAITID, pid, tag)) == NULL)
+        return -1;
+    sqe->len = P_PID;
+    sqe->file_index = WEXITED;
+    sqe->addr2 = (unsigned long) si;
+    return 0;
+}
+
+int rcmd_ring_next (rcmd_ring_t *ring, long *tag, int *res) {
+    struct io_uring_cqe *cqe;
+    unsigned head;
+    long n;
+
+    for (;;) {
+        head = *ring->cq_head;
+        if (head != __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            cqe = &ring->cqes[head & *ring->cq_mask];
+            *tag = cqe->user_data;
+            *res = cqe->res;
+            __atomic_store_n (ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            return 0;
+        }
+
+        /*the kernel takes the queued entries from sq_head to the tail, submit and wait in one call*/
+        if (ring->queued > 0) {
+            __atomic_store_n (ring->sq_tail, *ring->sq_tail + ring->queued, __ATOMIC_RELEASE);
+            ring->pending += ring->queued;
+            ring->queued = 0;
+        }
+        n = syscall (SYS_io_uring_enter, ring->fd, ring->pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            ring->broken = 1;
+            return -1;
+        }
+        ring->pending -= n > 0 ? n : 0;
+    }
+}
+
+#else
+
+int runcmd_io_engine (int engine) {
+    if (engine != RCMD_IO_POLL && engine != RCMD_IO_URING)
+        return -1;
+    return RCMD_IO_POLL;
+}
+
+rcmd_ring_t *rcmd_ring_get (void) {
+    return NULL;
+}
+
+void rcmd_ring_put (rcmd_ring_t *ring) {
+}
+
+int rcmd_ring_read (rcmd_ring_t *ring, int fd, void *buf, size_t len, long tag) {
+    return -1;
+}
+
+int rcmd_ring_splice (rcmd_ring_t *ring, int fd_in, int fd_out, size_t len, long tag) {
+    return -1;
+}
+
+int rcmd_ring_waitid (rcmd_ring_t *ring, pid_t pid, siginfo_t *si, long tag) {
+    return -1;
+}
+
+int rcmd_ring_next (rcmd_ring_t *ring, long *tag, int *res) {
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif
+
+int rcmd_ring_status (const siginfo_t *si) {
+    /*what wait4 would have given*/
+    switch (si->si_code) {
+        case CLD_EXITED: return (si->si_status & 0xff) << 8;
+        case CLD_DUMPED: return (si->si_status & 0x7f) | 0x80;
+        default: return si->si_status & 0x7f;
+    }
+}
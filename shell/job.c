@@ -20,14 +20,20 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <search.h>
 #include "utils.h"
+#include "parser.h"
 #include "process.h"
 #include "job.h"
 
-job_t* new_job (int input_redir, int output_redir, int error_redir) {
-    job_t *created_job = malloc (sizeof (job_t));
+job_t* new_job (arena_t *arena, int input_redir, int output_redir, int error_redir) {
+    job_t *created_job = arena_alloc (arena, sizeof (job_t));
+    sysfail (created_job==NULL, NULL);
+    created_job->arena = arena;
     created_job->process_list_head = NULL;
     created_job->process_list_tail = NULL;
     created_job->io[0]=input_redir;
@@ -36,14 +42,16 @@ job_t* new_job (int input_redir, int output_redir, int error_redir) {
     created_job->completed = 0;
     created_job->stopped = 0;
     created_job->lch = 0;
+    created_job->heap_index = -1;
     return created_job;
 }
 
 /*
    q_data will only point to proc, no copies are made
  */
-qelem* new_proc_node (process_t *proc) {
-    qelem *ptr = malloc (sizeof (qelem));
+qelem* new_proc_node (arena_t *arena, process_t *proc) {
+    qelem *ptr = arena_alloc (arena, sizeof (qelem));
+    sysfail (ptr==NULL, NULL);
     ptr->q_data = (void *) proc;
     ptr->q_forw = ptr->q_back = NULL;
     return ptr;
@@ -53,7 +61,7 @@ int job_push_process (job_t *job, process_t *proc) {
     qelem *ptr;
     sysfail (job==NULL, -1);
 
-    ptr = new_proc_node (proc);
+    ptr = new_proc_node (job->arena, proc);
     sysfail (ptr == NULL, -1);
 
     insque (ptr, job->process_list_tail);
@@ -67,18 +75,10 @@ int job_push_process (job_t *job, process_t *proc) {
 }
 
 void release_job (job_t *job) {
-    qelem *ptr, *aux;
     if (job == NULL)
         return ;
-    ptr = job->process_list_head;
-    while (ptr != NULL) {
-        aux = ptr;
-        ptr = ptr->q_forw;
-        release_process ((process_t *)aux->q_data);
-        remque (aux);
-        free (aux);
-    }
-    free (job);
+    /*the nodes and processes are in the arena too*/
+    release_arena (job->arena);
 }
 
 char job_completed (job_t *job) {
@@ -143,6 +143,22 @@ int run_job (job_t *job) {
     return EXIT_SUCCESS;
 }
 
+void kill_job (job_t *job) {
+    qelem *ptr;
+    process_t *proc;
+
+    for (ptr = job->process_list_head; ptr != NULL; ptr = ptr->q_forw) {
+        proc = (process_t *) ptr->q_data;
+        if (proc->pid <= 0 || proc->completed)
+            continue;
+        kill (proc->pid, SIGKILL);
+        while (waitpid (proc->pid, NULL, 0) < 0 && errno == EINTR)
+            ;
+        proc->completed = 1;
+    }
+    job->completed = 1;
+}
+
 void print_job_cmd (job_t *job, int fdes) {
     qelem *ptr;
     process_t *proc;
@@ -173,3 +189,163 @@ void job_set_stopped (job_t *job, char vsto) {
         ((process_t*)ptr->q_data)->stopped = 0;
     }
 }
+
+/*the table grows by doubling, so both sizes are powers of 2*/
+#define PID_BUCKET(table, pid) ((unsigned) (pid) & ((table)->pids_size - 1))
+
+int job_table_init (job_table_t *table) {
+    table->size = table->pids_size = JOB_TABLE_SIZE;
+    table->top = table->nheap = table->npids = 0;
+    table->jobs = calloc (table->size, sizeof (job_t *));
+    table->heap = malloc (table->size * sizeof (job_t *));
+    table->pids = calloc (table->pids_size, sizeof (process_t *));
+    sysfail (table->jobs==NULL || table->heap==NULL || table->pids==NULL, -1);
+    return 0;
+}
+
+/*1 if a must be above b in the heap*/
+static int job_before (const job_t *a, const job_t *b) {
+    return a->lch > b->lch || (a->lch == b->lch && a->jobid > b->jobid);
+}
+
+static void heap_set (job_table_t *table, int i, job_t *job) {
+    table->heap[i] = job;
+    job->heap_index = i;
+}
+
+static void heap_up (job_table_t *table, int i) {
+    job_t *job = table->heap[i];
+
+    for (; i > 0 && job_before (job, table->heap[(i - 1) / 2]); i = (i - 1) / 2)
+        heap_set (table, i, table->heap[(i - 1) / 2]);
+    heap_set (table, i, job);
+}
+
+static void heap_down (job_table_t *table, int i) {
+    job_t *job = table->heap[i];
+    int c;
+
+    while ((c = 2 * i + 1) < table->nheap) {
+        if (c + 1 < table->nheap && job_before (table->heap[c + 1], table->heap[c]))
+            ++c;
+        if (!job_before (table->heap[c], job))
+            break;
+        heap_set (table, i, table->heap[c]);
+        i = c;
+    }
+    heap_set (table, i, job);
+}
+
+static int pids_grow (job_table_t *table) {
+    int j, n = table->pids_size * 2;
+    process_t **pids = calloc (n, sizeof (process_t *)), *proc, *next;
+
+    sysfail (pids==NULL, -1);
+    for (j = 0; j < table->pids_size; ++j) {
+        for (proc = table->pids[j]; proc != NULL; proc = next) {
+            next = proc->pid_next;
+            proc->pid_next = pids[(unsigned) proc->pid & (n - 1)];
+            pids[(unsigned) proc->pid & (n - 1)] = proc;
+        }
+    }
+    free (table->pids);
+    table->pids = pids;
+    table->pids_size = n;
+    return 0;
+}
+
+int job_table_add (job_table_t *table, job_t *job) {
+    qelem *ptr;
+    process_t *proc;
+    job_t **aux;
+    int n;
+
+    if (table->top == table->size) {
+        n = table->size * 2;
+        aux = realloc (table->jobs, n * sizeof (job_t *));
+        sysfail (aux==NULL, -1);
+        memset (aux + table->size, 0, (n - table->size) * sizeof (job_t *));
+        table->jobs = aux;
+        aux = realloc (table->heap, n * sizeof (job_t *));
+        sysfail (aux==NULL, -1);
+        table->heap = aux;
+        table->size = n;
+    }
+    job->jobid = ++table->top;
+    table->jobs[job->jobid - 1] = job;
+    table->heap[table->nheap] = job;
+    heap_up (table, table->nheap++);
+
+    for (ptr = job->process_list_head; ptr != NULL; ptr = ptr->q_forw) {
+        proc = (process_t *) ptr->q_data;
+        proc->jobid = job->jobid;
+        /*builtins and commands not found have no pid*/
+        if (proc->pid <= 0 || proc->completed)
+            continue;
+        /*if it can't grow the chains just get longer*/
+        if (table->npids >= table->pids_size)
+            pids_grow (table);
+        proc->pid_next = table->pids[PID_BUCKET (table, proc->pid)];
+        table->pids[PID_BUCKET (table, proc->pid)] = proc;
+        ++table->npids;
+    }
+    return 0;
+}
+
+void job_table_remove (job_table_t *table, job_t *job) {
+    qelem *ptr;
+    job_t *last;
+    int i = job->heap_index;
+
+    for (ptr = job->process_list_head; ptr != NULL; ptr = ptr->q_forw)
+        job_table_forget_pid (table, (process_t *) ptr->q_data);
+
+    table->jobs[job->jobid - 1] = NULL;
+    while (table->top > 0 && table->jobs[table->top - 1] == NULL)
+        --table->top;
+
+    last = table->heap[--table->nheap];
+    if (i < table->nheap) {
+        heap_set (table, i, last);
+        heap_up (table, i);
+        heap_down (table, last->heap_index);
+    }
+}
+
+job_t *job_table_get (job_table_t *table, int jobid) {
+    return (jobid > 0 && jobid <= table->top) ? table->jobs[jobid - 1] : NULL;
+}
+
+job_t *job_table_curr (job_table_t *table) {
+    return (table->nheap > 0) ? table->heap[0] : NULL;
+}
+
+void job_table_touch (job_table_t *table, job_t *job, size_t lch) {
+    job->lch = lch;
+    heap_up (table, job->heap_index);
+    heap_down (table, job->heap_index);
+}
+
+process_t *job_table_find_pid (job_table_t *table, pid_t pid) {
+    process_t *proc;
+
+    for (proc = table->pids[PID_BUCKET (table, pid)]; proc != NULL; proc = proc->pid_next)
+        if (proc->pid == pid)
+            return proc;
+    return NULL;
+}
+
+void job_table_forget_pid (job_table_t *table, process_t *proc) {
+    process_t **p;
+
+    if (proc->pid <= 0)
+        return ;
+    for (p = &table->pids[PID_BUCKET (table, proc->pid)]; *p != NULL; p = &(*p)->pid_next) {
+        if (*p == proc) {
+            *p = proc->pid_next;
+            proc->pid_next = NULL;
+            --table->npids;
+            return ;
+        }
+    }
+}
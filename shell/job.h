@@ -22,6 +22,7 @@
 
 #include <search.h>
 #include "utils.h"
+#include "parser.h"
 #include "process.h"
 
 typedef struct {
@@ -35,11 +36,57 @@ typedef struct {
    char completed, stopped;
 
    size_t lch; /*last change*/ 
+   int heap_index; /*where it is in the job table heap*/
+
+   arena_t *arena; /*the job, its processes and its command line are all here*/
 
 }job_t;
 
-job_t* new_job () ;
+#define JOB_TABLE_SIZE 64 /*initial id slots and pid buckets, both double as needed*/
+
+/*
+   the jobs of the shell: jobs[id-1] is the job with that id (NULL if it's free),
+   the running processes are hashed by pid, and heap keeps the current job (the
+   greatest lch, then jobid) on top
+ */
+typedef struct {
+    job_t **jobs, **heap;
+    int size, top, nheap; /*slots in jobs and heap, greatest id in use, jobs in heap*/
+    process_t **pids; /*buckets chained by pid_next*/
+    int npids, pids_size;
+} job_table_t;
+
+/*empty table, returns -1 in case of error*/
+int job_table_init (job_table_t *table);
+
+/*
+   gives job the id after the greatest one in use and hashes its processes
+   (run_job must have been called), returns -1 in case of error
+ */
+int job_table_add (job_table_t *table, job_t *job);
+
+/*takes job out of the table, it isn't released*/
+void job_table_remove (job_table_t *table, job_t *job);
 
+/*NULL if there's no such job*/
+job_t *job_table_get (job_table_t *table, int jobid);
+
+/*the job used when fg or bg get no id (the last one changed), NULL if there are no jobs*/
+job_t *job_table_curr (job_table_t *table);
+
+/*sets the job's last change, keeping the heap in order*/
+void job_table_touch (job_table_t *table, job_t *job, size_t lch);
+
+/*the running process with that pid, NULL if none*/
+process_t *job_table_find_pid (job_table_t *table, pid_t pid);
+
+/*drops the process from the pid hash (e.g. it has finished, its pid may come again)*/
+void job_table_forget_pid (job_table_t *table, process_t *proc);
+
+/*the job is allocated in arena, which it owns from then on*/
+job_t* new_job (arena_t *arena, int input_redir, int output_redir, int error_redir) ;
+
+/*releases the job's arena, so every process and the command line go with it*/
 void release_job (job_t *job);
 
 /*
@@ -62,6 +109,12 @@ runs every process in the pipeline
  */
 int run_job (job_t *job);
 
+/*
+   kills (SIGKILL) and reaps the processes run_job started that haven't been
+   reaped, for a job that can't be kept; SIGCHLD must be blocked
+ */
+void kill_job (job_t *job);
+
 /*prints the entire job command line into fdes*/
 void print_job_cmd (job_t *job, int fdes) ; 
 
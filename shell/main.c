@@ -68,7 +68,8 @@ static struct argp argp = {options,parse_opt,args_doc,doc};
 
 int main (int argc, char *argv[]) {
 
-    char cmd[256];
+    char *cmd = NULL;
+    size_t cmd_size = 0;
     int ret, j;
     char hinter = 0;
 
@@ -82,6 +83,11 @@ int main (int argc, char *argv[]) {
 
     if (arguments.command == 1) { /**/
         size_t boff = 0;
+        for (j = 0; arguments.argv[j] != NULL; ++j)
+            cmd_size += strlen (arguments.argv[j]) + 1;
+        cmd = malloc (cmd_size + 1);
+        if (cmd == NULL)
+            return -1;
         for (j = 0; arguments.argv[j] != NULL; ++j) {
             strcpy (cmd + boff, arguments.argv[j]);
             boff += strlen (arguments.argv[j]);
@@ -107,7 +113,7 @@ int main (int argc, char *argv[]) {
         hinter = 0;
 
         /*this happens when we are block waiting and then comes a signal*/
-        if (fgets (cmd, 256, stdin)==NULL) {
+        if (getline (&cmd, &cmd_size, stdin) < 0) {
             hinter = 1;
             continue;
         }
@@ -119,7 +125,6 @@ int main (int argc, char *argv[]) {
             run_fgjob();
     }
 
-
-
+    free (cmd);
     return EXIT_SUCCESS;
 }
@@ -26,71 +26,196 @@
 #include "parser.h"
 #include "utils.h"
 
+/*the vectorised scanners need gcc (or clang) on a cpu with sse2 (every x86_64 has it)*/
+#if defined (__GNUC__) && defined (__SSE2__)
+#include <immintrin.h>
+#define PARSER_SIMD
+#endif
+
 #define IS_NONBLOCK(x) ((x)==NONBLOCK_CHAR)
 #define IS_INPUT_REDIR(x) ((x)==INPUT_REDIR_CHAR)
 #define IS_OUTPUT_REDIR(x) ((x)==OUTPUT_REDIR_CHAR)
 #define IS_IO_REDIR(x) (((x)==INPUT_REDIR_CHAR)||((x)==OUTPUT_REDIR_CHAR))
 #define IS_PIPE(x) ((x)==PIPE_CHAR)
+#define IS_OPERATOR(x) (IS_NONBLOCK (x) || IS_IO_REDIR (x) || IS_PIPE (x))
+/*the newline getline leaves and any other control character count as blanks*/
+#define IS_BLANK(x) ((x) != '\0' && (isblank ((unsigned char) (x)) || iscntrl ((unsigned char) (x))))
+#define IS_COMMENT(x) ((x)==COMMENT_CHAR)
+/*anything that can't end or change the meaning of a word, in the C locale bytes >= 0x80 are plain too*/
+#define IS_WORD_CHAR(x) ((unsigned char) (x) > ' ' && (x) != 0x7f && !IS_OPERATOR (x) \
+        && (x) != ESCAPE_CHAR && (x) != SQUOTE_CHAR && (x) != DQUOTE_CHAR)
+
+/*an arena released by release_arena, kept so most command lines don't call malloc at all*/
+static arena_t *spare_arena = NULL;
+
+arena_t *new_arena (void) {
+    arena_t *arena = spare_arena;
+
+    if (arena != NULL) {
+        spare_arena = NULL;
+        return arena;
+    }
+    arena = malloc (sizeof (arena_t));
+    sysfail (arena==NULL, NULL);
+    arena->head = NULL;
+    return arena;
+}
+
+void *arena_alloc (arena_t *arena, size_t size) {
+    arena_block_t *block = arena->head;
+    size_t n;
+    void *ptr;
+
+    /*every allocation starts aligned*/
+    size = (size + sizeof (block->align) - 1) / sizeof (block->align) * sizeof (block->align);
+    if (block == NULL || block->size - block->used < size) {
+        n = (size > ARENA_BLOCK) ? size : ARENA_BLOCK;
+        block = malloc (sizeof (arena_block_t) + n);
+        sysfail (block==NULL, NULL);
+        block->size = n;
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    ptr = (char *) (block + 1) + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void release_arena (arena_t *arena) {
+    arena_block_t *block;
+
+    if (arena == NULL)
+        return ;
+    /*only the first block is kept*/
+    while (arena->head != NULL && arena->head->next != NULL) {
+        block = arena->head;
+        arena->head = block->next;
+        free (block);
+    }
+    if (arena->head != NULL)
+        arena->head->used = 0;
 
-cmd_line_t* new_cmd_line (void) {
-    cmd_line_t *cmd = malloc (sizeof (cmd_line_t));
+    if (spare_arena == NULL) {
+        spare_arena = arena;
+        return ;
+    }
+    free (arena->head);
+    free (arena);
+}
+
+cmd_line_t* new_cmd_line (arena_t *arena) {
+    cmd_line_t *cmd = arena_alloc (arena, sizeof (cmd_line_t));
     sysfail (cmd==NULL, NULL);
     cmd->io[0] = cmd->io[1] = cmd->io[2] = NULL;
+    cmd->io_append[0] = cmd->io_append[1] = cmd->io_append[2] = 0;
     cmd->pipe_list_head = NULL;
     cmd->pipe_list_tail = NULL;
     cmd->is_nonblock = 0;
+    cmd->arena = arena;
     return cmd;
 }
 
 /*
-   copies the first n bytes of a string
-    also puts a \0 at the end 
-    also trims the string
+   scan_word returns how many bytes from r (up to end) are IS_WORD_CHAR, most of
+   a long line (e.g. a generated list of files) are such runs, so they are
+   classified 16 (sse2) or 32 (avx2) bytes at a time, the implementation is
+   picked the first time it is called
  */
-char *stringndup(const char *str, size_t n) {
-    char *rstr;
-    int poff=0; /*offset, how many bytes are blank at the begining*/
+static size_t scan_word_scalar (const char *r, const char *end) {
+    const char *p = r;
 
-    /*triming*/
-    while (str[poff] != '\0' && (iscntrl (str[poff]) || isblank (str[poff])))
-        poff++;
-    n -= poff;
-    while (n>0 && (iscntrl (str[poff + n-1]) || isblank (str[poff + n - 1])))
-        --n;
-    /*end triming*/
+    while (p < end && IS_WORD_CHAR (*p))
+        ++p;
+    return p - r;
+}
 
-    rstr = malloc (sizeof (char) * (n+1));
-    sysfail (rstr==NULL, NULL);
+#ifdef PARSER_SIMD
+/*bitmask of the bytes in the 16 from p that are not IS_WORD_CHAR*/
+static int special_mask_sse2 (const char *p) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) p);
+    /*blanks, controls and \0 are the bytes <= ' ' (unsigned)*/
+    __m128i m = _mm_cmpeq_epi8 (_mm_min_epu8 (v, _mm_set1_epi8 (' ')), v);
+
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 (0x7f)));
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 (PIPE_CHAR)));
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 (INPUT_REDIR_CHAR)));
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 (OUTPUT_REDIR_CHAR)));
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 (NONBLOCK_CHAR)));
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 (ESCAPE_CHAR)));
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 (SQUOTE_CHAR)));
+    m = _mm_or_si128 (m, _mm_cmpeq_epi8 (v, _mm_set1_epi8 (DQUOTE_CHAR)));
+    return _mm_movemask_epi8 (m);
+}
+
+static size_t scan_word_sse2 (const char *r, const char *end) {
+    const char *p;
+    int mask;
 
-    rstr[n] = '\0';
-    strncpy (rstr, str + poff, n);
-    return rstr;
+    /*only whole blocks before end are loaded, the tail is done one by one*/
+    for (p = r; end - p >= 16; p += 16) {
+        mask = special_mask_sse2 (p);
+        if (mask != 0)
+            return p - r + __builtin_ctz (mask);
+    }
+    return p - r + scan_word_scalar (p, end);
 }
 
-/*cmd_str -> start of the command
-    n     -> number of bytes which is in the command 
- */
-struct qelem *new_qelem (const char *cmd_str, size_t n) {
-    struct qelem *rqelem = malloc (sizeof (struct qelem));
-    sysfail (rqelem==NULL, NULL);
-    rqelem->q_forw = NULL;
-    rqelem->q_back = NULL;
-    rqelem->q_data = (char *)stringndup (cmd_str, n);
-    return rqelem;
+/*same as special_mask_sse2, 32 bytes*/
+__attribute__ ((target ("avx2")))
+static unsigned special_mask_avx2 (const char *p) {
+    __m256i v = _mm256_loadu_si256 ((const __m256i *) p);
+    __m256i m = _mm256_cmpeq_epi8 (_mm256_min_epu8 (v, _mm256_set1_epi8 (' ')), v);
+
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 (0x7f)));
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 (PIPE_CHAR)));
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 (INPUT_REDIR_CHAR)));
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 (OUTPUT_REDIR_CHAR)));
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 (NONBLOCK_CHAR)));
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 (ESCAPE_CHAR)));
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 (SQUOTE_CHAR)));
+    m = _mm256_or_si256 (m, _mm256_cmpeq_epi8 (v, _mm256_set1_epi8 (DQUOTE_CHAR)));
+    return (unsigned) _mm256_movemask_epi8 (m);
 }
 
-/*
-returns -1 in case of error 
- */
-int pipe_list_push_cmd (cmd_line_t *cmd_line, const char *cmd_str, size_t n) {
-    struct qelem *nelem = new_qelem (cmd_str, n); 
-    sysfail (nelem==NULL, -1);
-
-    if (strlen (nelem->q_data) == 0) {
-        free (nelem->q_data);
-        free (nelem);
-        return EMPTY_LINE;
+__attribute__ ((target ("avx2")))
+static size_t scan_word_avx2 (const char *r, const char *end) {
+    const char *p;
+    unsigned mask;
+
+    for (p = r; end - p >= 32; p += 32) {
+        mask = special_mask_avx2 (p);
+        if (mask != 0)
+            return p - r + __builtin_ctz (mask);
     }
+    return p - r + scan_word_sse2 (p, end);
+}
+#endif
+
+static size_t scan_word_init (const char *r, const char *end);
+static size_t (*scan_word) (const char *r, const char *end) = scan_word_init;
+
+static size_t scan_word_init (const char *r, const char *end) {
+#ifdef PARSER_SIMD
+    __builtin_cpu_init ();
+    scan_word = __builtin_cpu_supports ("avx2") ? scan_word_avx2 : scan_word_sse2;
+#else
+    scan_word = scan_word_scalar;
+#endif
+    return scan_word (r, end);
+}
+
+/*adds a command (its argv, copied from words) to the pipeline*/
+static int pipe_list_push_argv (cmd_line_t *cmd_line, char **words, int nwords) {
+    struct qelem *nelem = arena_alloc (cmd_line->arena, sizeof (struct qelem));
+    char **argv = arena_alloc (cmd_line->arena, sizeof (char *) * (nwords + 1));
+
+    sysfail (nelem==NULL || argv==NULL, -1);
+    memcpy (argv, words, sizeof (char *) * nwords);
+    argv[nwords] = NULL;
+    nelem->q_forw = NULL;
+    nelem->q_back = NULL;
+    nelem->q_data = (char *) argv;
 
     insque (nelem, cmd_line->pipe_list_tail);
     cmd_line->pipe_list_tail = nelem;
@@ -99,145 +224,268 @@ int pipe_list_push_cmd (cmd_line_t *cmd_line, const char *cmd_str, size_t n) {
     return EXIT_SUCCESS;
 }
 
-
 /*
 returns:
 0 in case of succes 
-1 in ... (still not in use)
-2 in syntax error
+EMPTY_LINE if there's nothing but blanks (or a comment)
+SYNTAX_ERROR in syntax error
 -1 in unexpected error
+
+the line is read once: each word is unquoted as it is scanned and written (only
+once) to a buffer in the arena, the argv of a command and the redirections get
+pointers into it, a command goes to the pipeline when its '|' (or the end) is seen
  */
 int parse_cmd_line (cmd_line_t *cmd_line, const char *cmd) {
-    size_t prv_cmd_beg = 0, i, cmd_len;
-
-    /*used to get return of functions*/
-    int raux;
-    /*STDIN, STDOUT, STDERR*/
-    int io_redir_seen=-1;
-    /*return status*/
-    int ret = 0;
+    const char *r = cmd, *end, *q;
+    char *w, *word, *stack_words[CMD_MAXARGS], **words = stack_words, **nw;
+    int nwords = 0, maxwords = CMD_MAXARGS, ncmds = 0, quoted;
+    size_t n;
+    /*redirection waiting for its file name: STDIN, STDOUT, STDERR*/
+    int io_redir_seen = -1;
 
     sysfail (cmd_line==NULL, -1);
-    cmd_len = strlen (cmd);
-
-    while (cmd_len>0 && (iscntrl (cmd[cmd_len-1]) || isblank (cmd[cmd_len - 1])))
-        --cmd_len;
-
-    if (cmd_len == 0) {
-        ret |= EMPTY_LINE;
-        return ret;
-    }
-
-    /*assuming that the last thing is io redirection or nonblocking indicator*/
-    for (i=0; i < cmd_len && !IS_IO_REDIR (cmd[i]) && !IS_NONBLOCK (cmd[i]); ++i) {
-        if (IS_PIPE (cmd[i])) {
-            raux = pipe_list_push_cmd (cmd_line, cmd + prv_cmd_beg, i-prv_cmd_beg);
-            sysfail (raux<0, -1);
-            prv_cmd_beg = i + 1;
+    end = cmd + strlen (cmd);
+    /*a word takes at most its own bytes plus the blank or operator after it for the \0*/
+    w = arena_alloc (cmd_line->arena, end - cmd + 1);
+    sysfail (w==NULL, -1);
+
+    for (;;) {
+        while (IS_BLANK (*r))
+            ++r;
+        if (IS_COMMENT (*r))
+            r = end;
+
+        /*end of a command*/
+        if (*r == '\0' || IS_PIPE (*r) || IS_NONBLOCK (*r)) {
+            if (io_redir_seen != -1)
+                return SYNTAX_ERROR;
+            if (nwords == 0)
+                return (*r == '\0' && ncmds == 0) ? EMPTY_LINE : SYNTAX_ERROR;
+            sysfail (pipe_list_push_argv (cmd_line, words, nwords)<0, -1);
+            ++ncmds;
+            nwords = 0;
+            if (*r == '\0')
+                return EXIT_SUCCESS;
+            if (IS_PIPE (*r)) {
+                ++r;
+                continue;
+            }
+            /*if it is non_block it must be the last thing*/
+            cmd_line->is_nonblock = 1;
+            for (++r; IS_BLANK (*r); ++r)
+                ;
+            return (*r == '\0' || IS_COMMENT (*r)) ? EXIT_SUCCESS : SYNTAX_ERROR;
         }
-    }
 
-    /*last command (the one that comes after the last pipe)*/
-    if (prv_cmd_beg < cmd_len) {
-        raux = pipe_list_push_cmd (cmd_line, cmd + prv_cmd_beg, i-prv_cmd_beg);
-        sysfail (raux<0, -1);
-        if (IS_EMPTY_LINE (raux)) {
-            if (cmd_line->pipe_list_head != NULL)
-                ret |= SYNTAX_ERROR;
-            else ret |= EMPTY_LINE;
-            return ret;
+        /*<, >, >>, 2> and 2>>*/
+        if (IS_IO_REDIR (*r) || (r[0] == ERROR_REDIR_CHAR && IS_OUTPUT_REDIR (r[1]))) {
+            if (io_redir_seen != -1)
+                return SYNTAX_ERROR;
+            if (*r == ERROR_REDIR_CHAR) {
+                io_redir_seen = STDERR_FILENO;
+                ++r;
+            }
+            else
+                io_redir_seen = IS_INPUT_REDIR (*r) ? STDIN_FILENO : STDOUT_FILENO;
+            ++r;
+            cmd_line->io_append[io_redir_seen] = io_redir_seen != STDIN_FILENO && IS_OUTPUT_REDIR (*r);
+            if (cmd_line->io_append[io_redir_seen])
+                ++r;
+            continue;
         }
-        prv_cmd_beg = i + 1;
-    }
 
-    for (;i < cmd_len && !IS_NONBLOCK(cmd[i]); ++i) {
-        /*todo: recognize output redir*/
-        if (IS_IO_REDIR (cmd[i])) { 
-            if (io_redir_seen != -1)
-                cmd_line->io[io_redir_seen] = stringndup (cmd + prv_cmd_beg, i-prv_cmd_beg);
-            prv_cmd_beg = i + 1;
-            io_redir_seen = (IS_INPUT_REDIR (cmd[i])) ? 0 : 1;
+        /*a word, which may be made of quoted and unquoted parts*/
+        word = w;
+        quoted = 0;
+        while (*r != '\0' && !IS_BLANK (*r) && !IS_OPERATOR (*r)) {
+            if (*r == ESCAPE_CHAR) {
+                /*a backslash and a newline are dropped, they just continue the line*/
+                if (*++r == '\n')
+                    ++r;
+                else if (*r != '\0')
+                    *w++ = *r++;
+            }
+            else if (*r == SQUOTE_CHAR) {
+                /*everything up to the next ' is taken as it is*/
+                quoted = 1;
+                ++r;
+                q = memchr (r, SQUOTE_CHAR, end - r);
+                if (q == NULL)
+                    return SYNTAX_ERROR;
+                memcpy (w, r, q - r);
+                w += q - r;
+                r = q + 1;
+            }
+            else if (*r == DQUOTE_CHAR) {
+                /*only \" and \\ are escapes inside "*/
+                quoted = 1;
+                for (++r; *r != DQUOTE_CHAR; ++r) {
+                    n = strcspn (r, "\"\\");
+                    memcpy (w, r, n);
+                    w += n;
+                    r += n;
+                    if (*r == '\0')
+                        return SYNTAX_ERROR;
+                    if (*r == DQUOTE_CHAR)
+                        break;
+                    if (r[1] == DQUOTE_CHAR || r[1] == ESCAPE_CHAR)
+                        ++r;
+                    *w++ = *r;
+                }
+                ++r;
+            }
+            else {
+                /*the whole run of plain characters at once (*r is one of them)*/
+                n = scan_word (r, end);
+                memcpy (w, r, n);
+                w += n;
+                r += n;
+            }
+        }
+        /*nothing but a line continuation*/
+        if (w == word && !quoted)
+            continue;
+        *w++ = '\0';
+
+        if (io_redir_seen != -1)
+            cmd_line->io[io_redir_seen] = word;
+        else {
+            /*long argument lists outgrow the stack, the rest go to the arena*/
+            if (nwords == maxwords) {
+                nw = arena_alloc (cmd_line->arena, sizeof (char *) * maxwords * 2);
+                sysfail (nw==NULL, -1);
+                memcpy (nw, words, sizeof (char *) * nwords);
+                words = nw;
+                maxwords *= 2;
+            }
+            words[nwords++] = word;
         }
-        else if (IS_PIPE (cmd[i]))
-                ret |= SYNTAX_ERROR;
+        io_redir_seen = -1;
     }
-
-    if (prv_cmd_beg < cmd_len && io_redir_seen != -1) 
-        cmd_line->io[io_redir_seen] = stringndup (cmd + prv_cmd_beg, i-prv_cmd_beg);
-
-    /*if it is non_block it must be the last thing*/
-    cmd_line->is_nonblock = i < cmd_len && IS_NONBLOCK (cmd[i]);
-
-    if (i < cmd_len-1)
-        ret |= SYNTAX_ERROR;
-    
-    return ret;
 } 
 
-/*  DO NOT forget to call this function, after you're done parsing,
-    otherwise you'll get memory leak!!*/
-void release_cmd_line (cmd_line_t *cmd_line) {
-    /**/
-    struct qelem *ptr, *aux = NULL;
-    size_t i;
-
-    if (cmd_line == NULL)
-        return ;
+/*
+   parser test, prints how each line of stdin is parsed (see test/parser.sh),
+   'make check' in shell/ builds it as parser-test
+ */
 
-    for (ptr = cmd_line->pipe_list_tail; ptr != NULL; ) {
-        free (ptr->q_data);
-        aux = ptr->q_back;
-        remque (ptr);
-        free (ptr);
-        ptr = aux;
+#ifdef PARSER_TEST
+static void print (cmd_line_t *cmd_line) {
+    static const char *redir[] = {"<", ">", "2>"};
+    struct qelem *ptr = cmd_line->pipe_list_head;
+    char **argv;
+    int c = 0, i;
+
+    for (; ptr != NULL; ptr = ptr->q_forw) {
+        printf ("%d:", ++c);
+        for (argv = (char **) ptr->q_data; *argv != NULL; ++argv)
+            printf (" [%s]", *argv);
+        putchar ('\n');
     }
-
-    for (i=0; i<3; ++i)
+    for (i = 0; i < 3; ++i)
         if (cmd_line->io[i] != NULL)
-            free (cmd_line->io[i]);
-    free (cmd_line);
+            printf ("%s%s [%s]\n", redir[i], cmd_line->io_append[i] ? ">" : "", cmd_line->io[i]);
+    if (cmd_line->is_nonblock)
+        puts ("&");
 }
 
+int main (void) {
+    char *cmd = NULL;
+    size_t cmd_size = 0;
+    int raux;
+    cmd_line_t *cmd_line;
+    arena_t *arena;
 
-/*
-test parser 
- */
+    while (getline (&cmd, &cmd_size, stdin) >= 0) {
+        printf ("%s", cmd);
+        arena = new_arena ();
+        cmd_line = new_cmd_line (arena);
+        raux = parse_cmd_line (cmd_line, cmd);
+        if (IS_SYNTAX_ERROR (raux))
+            puts ("Syntax Error");
+        else if (IS_EMPTY_LINE (raux))
+            puts ("Empty Line");
+        else if (IS_CMD_LINE_OK (raux))
+            print (cmd_line);
+        else
+            puts ("Error");
+        puts ("------");
+        release_arena (arena);
+    }
+    free (cmd);
+    return EXIT_SUCCESS;
+}
+#endif
 
 /*
+   parser benchmark, prints CSV (bytes of the line, scanner, MB/s), 'make benchmark'
+   in shell/ builds it as parser-bench and writes parser-bench.csv
+ */
 
-void print (cmd_line_t *cmd_line) {
-    int c = 0;
-    struct qelem *ptr = cmd_line->pipe_list_head;
+#ifdef PARSER_BENCH
+#include <time.h>
 
-    printf("INPUT %s\n", (cmd_line->io[0]==NULL) ? "STDIN" : cmd_line->io[0]);
-    printf("OUTPUT %s\n", (cmd_line->io[1]==NULL) ? "STDOUT" :cmd_line->io[1]);
-    printf("IS_NONBLOCK %d\n", cmd_line->is_nonblock);
+#define BENCH_BYTES (256L << 20) /*parsed per row*/
 
-    while (ptr != NULL) {
-        printf("%d: %s\n", ++c, ptr->q_data);
-        ptr = ptr->q_forw;
-    }
-    puts("------");
+static double now (void) {
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
+/*a generated line of about size bytes: a command with a long list of files and a pipe*/
+static char *make_line (size_t size) {
+    char *line = malloc (size + 64), *p = line;
+    int j;
+
+    if (line == NULL)
+        return NULL;
+    p += sprintf (p, "ls -l");
+    for (j = 0; (size_t) (p - line) < size; ++j)
+        p += sprintf (p, (j % 16) ? " src/module_%04d/file_%05d.c" : " 'src/my dir/file_%04d %05d.c'", j / 64, j);
+    sprintf (p, " | wc -l > out.txt\n");
+    return line;
+}
 
-
-int main(void) {
-    int raux;
-    cmd_line_t *cmd_line = NULL;
-
-    char cmd[555];
-    while (fgets (cmd, 554, stdin) != NULL ) {
-        cmd_line = new_cmd_line ();
-        raux = parse_cmd_line (cmd_line, cmd);
-        if (IS_SYNTAX_ERROR (raux))
-            puts ("Syntax Error!");
-        else
-            print (cmd_line);
-        release_cmd_line (cmd_line);
-
+static double bench (const char *line, size_t (*scan) (const char *, const char *)) {
+    arena_t *arena;
+    cmd_line_t *cmd_line;
+    long i, n = BENCH_BYTES / strlen (line) + 1;
+    double start;
+
+    scan_word = scan;
+    start = now ();
+    for (i = 0; i < n; ++i) {
+        arena = new_arena ();
+        cmd_line = new_cmd_line (arena);
+        if (!IS_CMD_LINE_OK (parse_cmd_line (cmd_line, line))) {
+            fprintf (stderr, "parse error\n");
+            exit (EXIT_FAILURE);
+        }
+        release_arena (arena);
     }
+    return (double) n * strlen (line) / (now () - start) / 1e6;
+}
 
-    return 0;
+int main (void) {
+    static const size_t sizes[] = {64, 1024, 64 * 1024, 512 * 1024};
+    char *line;
+    int i;
+
+    puts ("bytes,scanner,mb_per_sec");
+    for (i = 0; i < (int) (sizeof (sizes) / sizeof (sizes[0])); ++i) {
+        line = make_line (sizes[i]);
+        if (line == NULL)
+            return EXIT_FAILURE;
+        printf ("%lu,scalar,%.1f\n", (unsigned long) strlen (line), bench (line, scan_word_scalar));
+#ifdef PARSER_SIMD
+        printf ("%lu,sse2,%.1f\n", (unsigned long) strlen (line), bench (line, scan_word_sse2));
+        __builtin_cpu_init ();
+        if (__builtin_cpu_supports ("avx2"))
+            printf ("%lu,avx2,%.1f\n", (unsigned long) strlen (line), bench (line, scan_word_avx2));
+#endif
+        free (line);
+    }
+    return EXIT_SUCCESS;
 }
-*/
+#endif
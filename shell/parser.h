@@ -26,6 +26,13 @@
 #define PIPE_CHAR '|'
 #define INPUT_REDIR_CHAR '<'
 #define OUTPUT_REDIR_CHAR '>'
+#define ERROR_REDIR_CHAR '2' /*2> and 2>> redirect the standard error*/
+#define ESCAPE_CHAR '\\'
+#define SQUOTE_CHAR '\''
+#define DQUOTE_CHAR '"'
+#define COMMENT_CHAR '#'
+
+#define CMD_MAXARGS 256 /*words of a command kept on the stack, longer ones move to the arena*/
 
 #define SYNTAX_ERROR (1<<1)
 #define EMPTY_LINE (1<<2)
@@ -34,24 +41,48 @@
 #define IS_CMD_LINE_OK(x) ((x)==EXIT_SUCCESS)
 
 
+/*
+   bump allocator for everything built from one command line (the cmd_line_t, 
+   the job and its processes), it is released at once, with the job
+ */
+#define ARENA_BLOCK 8192
+
+typedef struct arena_block_t {
+    struct arena_block_t *next; /*the block filled before this one*/
+    size_t size, used;
+    union { long l; double d; void *p; } align; /*the memory that follows is aligned for anything*/
+} arena_block_t;
+
+typedef struct arena_t {
+    arena_block_t *head; /*block being filled*/
+} arena_t;
+
+arena_t *new_arena (void);
+
+/*returns size bytes that live until the arena is released, NULL in case of error*/
+void *arena_alloc (arena_t *arena, size_t size);
+
+/*frees everything allocated from arena (the arena itself is kept for the next new_arena)*/
+void release_arena (arena_t *arena);
+
 typedef struct cmd_line_t {
     char *io[3]; /*standard is {NULL,NULL,NULL}..., meaning no redirection*/
+    int io_append[3]; /*1 if the file is appended to (>>), truncated otherwise*/
     int is_nonblock;
-    struct qelem *pipe_list_tail, *pipe_list_head; /*note that if there's no pipe this is a one element list, check <search.h> to see struct qelem */
+    struct qelem *pipe_list_tail, *pipe_list_head; /*note that if there's no pipe this is a one element list, check <search.h> to see struct qelem; q_data is the NULL terminated argv of the command*/
+    arena_t *arena; /*where the cmd_line_t, the commands and the file names are*/
 } cmd_line_t;
 
 
-/*allocate memory for parser*/
-cmd_line_t* new_cmd_line (void); 
+/*allocate memory for parser, everything goes into arena*/
+cmd_line_t* new_cmd_line (arena_t *arena); 
 
 /*
    parses the cmd string, return -1 in case of error
-notes: & must be the last thing (anything after will be ignored)
-        (<,>) must come after all the pipes
+notes: & must be the last thing (only a comment may follow)
+        redirections (<, >, >>, 2>, 2>>) may be anywhere, they apply to the whole pipeline
+        '...' is taken literally, "..." only knows \" and \\, \ escapes any other character
  */
 int parse_cmd_line (cmd_line_t *cmd_line, const char *cmd) ; 
 
-/*releases all the allocated memory*/
-void release_cmd_line (cmd_line_t *cmd_line);
-
 #endif
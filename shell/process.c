@@ -23,13 +23,140 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <signal.h>
 #include <fcntl.h>
 #include "utils.h"
+#include "parser.h"
 #include "process.h"
 
 
-char* builtin_cmd [] = {"cd", "jobs", "fg", "bg", "exit", "quit", NULL};
+char* builtin_cmd [] = {"cd", "jobs", "fg", "bg", "exit", "quit", "hash", NULL};
+
+/*
+   command hash table, name -> absolute path found in PATH, so commands are
+   resolved before forking and the children don't walk PATH with execvp
+ */
+typedef struct hash_entry_t {
+    char *name;
+    char *path;
+    int hits;
+    struct hash_entry_t *next; /*next in the same bucket*/
+} hash_entry_t;
+
+hash_entry_t *hash_table[HASH_SIZE];
+
+/*PATH the table was filled with, it is emptied when PATH changes*/
+char *hash_path = NULL;
+
+/*what execvp searches when PATH is unset*/
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+static unsigned int hash_index (const char *name) {
+    unsigned int h = 5381;
+    for (; *name; ++name)
+        h = h * 33 + (unsigned char) *name;
+    return h % HASH_SIZE;
+}
+
+void hash_reset (void) {
+    hash_entry_t *entry, *aux;
+    int i;
+
+    for (i = 0; i < HASH_SIZE; ++i) {
+        for (entry = hash_table[i]; entry != NULL; entry = aux) {
+            aux = entry->next;
+            free (entry->name);
+            free (entry->path);
+            free (entry);
+        }
+        hash_table[i] = NULL;
+    }
+    free (hash_path);
+    hash_path = NULL;
+}
+
+/*1 if path is a regular file we can execute*/
+static int is_executable (const char *path) {
+    struct stat st;
+    return stat (path, &st) == 0 && S_ISREG (st.st_mode) && access (path, X_OK) == 0;
+}
+
+/*searches name in every directory of PATH, returns a malloc'ed path or NULL*/
+static char *search_path (const char *name) {
+    const char *dir, *end, *path = getenv ("PATH");
+    size_t len, nlen = strlen (name);
+    char *full;
+
+    if (path == NULL)
+        path = DEFAULT_PATH;
+    for (dir = path; ; dir = end + 1) {
+        end = strchr (dir, ':');
+        if (end == NULL)
+            end = dir + strlen (dir);
+        /*an empty entry is the current directory*/
+        len = (end == dir) ? 1 : (size_t) (end - dir);
+        full = malloc (len + nlen + 2);
+        sysfail (full == NULL, NULL);
+        memcpy (full, (end == dir) ? "." : dir, len);
+        full[len] = '/';
+        strcpy (full + len + 1, name);
+        if (is_executable (full))
+            return full;
+        free (full);
+        if (*end == '\0')
+            return NULL;
+    }
+}
+
+const char *hash_lookup (const char *name) {
+    const char *path = getenv ("PATH");
+    hash_entry_t **ptr, *entry;
+    char *found;
+
+    /*not searched in PATH*/
+    if (strchr (name, '/') != NULL)
+        return name;
+
+    /*an unset PATH is searched as the default, so the table is kept for it too*/
+    if (path == NULL)
+        path = DEFAULT_PATH;
+    if (hash_path == NULL || strcmp (hash_path, path) != 0) {
+        hash_reset ();
+        hash_path = strdup (path);
+    }
+
+    for (ptr = &hash_table[hash_index (name)]; *ptr != NULL; ptr = &(*ptr)->next) {
+        entry = *ptr;
+        if (strcmp (entry->name, name) != 0)
+            continue;
+        if (is_executable (entry->path)) {
+            ++entry->hits;
+            return entry->path;
+        }
+        /*it is gone, searched again*/
+        *ptr = entry->next;
+        free (entry->name);
+        free (entry->path);
+        free (entry);
+        break;
+    }
+
+    found = search_path (name);
+    if (found == NULL)
+        return NULL;
+    entry = malloc (sizeof (hash_entry_t));
+    if (entry == NULL || (entry->name = strdup (name)) == NULL) {
+        free (entry);
+        free (found);
+        return NULL;
+    }
+    entry->path = found;
+    entry->hits = 1;
+    entry->next = hash_table[hash_index (name)];
+    hash_table[hash_index (name)] = entry;
+    return entry->path;
+}
 
 int builtin_cd (process_t *proc, int input_redir, int output_redir, int error_redir) {
     if (proc->argv[1] != NULL)
@@ -70,7 +197,35 @@ int builtin_exit (process_t *proc, int input_redir, int output_redir, int error_
 }
 
 
-int (*builtin_func[6]) (process_t *, int, int, int) = {builtin_cd, builtin_jobs, builtin_fg, builtin_bg, builtin_exit, builtin_exit};
+/*hash lists the table, hash -r empties it and hash name... adds names to it*/
+int builtin_hash (process_t *proc, int input_redir, int output_redir, int error_redir) {
+    hash_entry_t *entry;
+    int i, ret = 0;
+
+    if (proc == NULL)
+        return -1;
+    if (proc->argv[1] != NULL && strcmp (proc->argv[1], "-r") == 0) {
+        hash_reset ();
+        return 0;
+    }
+    if (proc->argv[1] == NULL) {
+        dprintf (output_redir, "hits\tcommand\n");
+        for (i = 0; i < HASH_SIZE; ++i)
+            for (entry = hash_table[i]; entry != NULL; entry = entry->next)
+                dprintf (output_redir, "%4d\t%s\n", entry->hits, entry->path);
+        return 0;
+    }
+    for (i = 1; proc->argv[i] != NULL; ++i) {
+        if (hash_lookup (proc->argv[i]) == NULL) {
+            dprintf (error_redir, "hash: %s: not found\n", proc->argv[i]);
+            ret = 1;
+        }
+    }
+    return ret;
+}
+
+
+int (*builtin_func[7]) (process_t *, int, int, int) = {builtin_cd, builtin_jobs, builtin_fg, builtin_bg, builtin_exit, builtin_exit, builtin_hash};
 
 /*checks if proc is a bultin cmd and returns the id of the function*/
 int chk_builtincmd (process_t *proc) {
@@ -81,38 +236,27 @@ int chk_builtincmd (process_t *proc) {
     return -1;
 }
 
-process_t* new_process (const char *command) {
-    size_t i;
-    char *token, *cmd;   
+process_t* new_process (arena_t *arena, char **argv) {
     process_t *rprocess;
 
-    cmd = malloc (sizeof (char) * (strlen (command)+1));
-    rprocess = malloc (sizeof (process_t));
+    rprocess = arena_alloc (arena, sizeof (process_t));
+    sysfail (rprocess==NULL, NULL);
     rprocess->completed = 0;
     rprocess->stopped = 0;
     rprocess->status = 0;
-    strcpy (cmd, command);
-
-    token = strtok (cmd, CMD_DELIM);
-    for (i=0; i<CMD_MAXARGS && token != NULL; ++i) {
-        rprocess->argv[i]=token;
-        token = strtok (NULL, CMD_DELIM);
-    }
-    rprocess->argv[i] = NULL;
+    rprocess->pid = 0; /*until run_process forks it*/
+    rprocess->argv = argv;
+    rprocess->jobid = 0;
+    rprocess->pid_next = NULL;
     return rprocess;
 }
 
-void release_process (process_t *proc) {
-    /*as we used strtok to build this string we just need 1 free*/
-    if (proc->argv[0] != NULL)
-        free (proc->argv[0]);
-    free (proc);
-}
-
 /*if pid is 0, then it's a builtin function*/
 pid_t run_process (process_t *proc, pid_t pgid, int input_redir, int output_redir, int error_redir) {
     pid_t pid;
     int builtin_id;
+    const char *path;
+    sigset_t chld;
     builtin_id = chk_builtincmd (proc);
 
     if (builtin_id != -1) {
@@ -122,6 +266,16 @@ pid_t run_process (process_t *proc, pid_t pgid, int input_redir, int output_redi
         return proc->pid;
     }
 
+    /*an unknown command is reported without forking, it finishes like a builtin*/
+    path = hash_lookup (proc->argv[0]);
+    if (path == NULL) {
+        dprintf (error_redir, "%s: command not found\n", proc->argv[0]);
+        proc->status = CMD_NOT_FOUND << 8;
+        proc->completed = 1;
+        proc->pid = 0;
+        return proc->pid;
+    }
+
     pid = fork();
 
     /*returns -1 if fork failed*/
@@ -141,7 +295,11 @@ pid_t run_process (process_t *proc, pid_t pgid, int input_redir, int output_redi
         signal (SIGTTIN, SIG_DFL);
         signal (SIGTTOU, SIG_DFL);
         signal (SIGCHLD, SIG_DFL);
-        
+        /*the shell has it blocked while it starts a job*/
+        sigemptyset (&chld);
+        sigaddset (&chld, SIGCHLD);
+        sigprocmask (SIG_UNBLOCK, &chld, NULL);
+
 
         /*io redirection*/
         if (input_redir != STDIN_FILENO) {
@@ -157,13 +315,13 @@ pid_t run_process (process_t *proc, pid_t pgid, int input_redir, int output_redi
             close (error_redir);
         }
 
+        execv (path, proc->argv);
+        /*not a binary (a script without #!) or gone since it was hashed*/
         execvp (proc->argv[0], proc->argv);
 
         /*we have something wrong */
         dprintf (output_redir, "%s: %s\n", proc->argv[0], strerror (errno));
 
-        release_process (proc);
-
         exit (RUN_PROC_FAILURE);
     }
     return pid;
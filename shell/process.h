@@ -21,23 +21,26 @@
 #ifndef PROC_H
 #define PROC_H
 
-#define CMD_DELIM " \n\t\r"
-#define CMD_MAXARGS 256
+#include "parser.h"
 
 #define RUN_PROC_FAILURE 0
 
-typedef struct {
+/*buckets of the command hash table and exit status of a command not found*/
+#define HASH_SIZE 64
+#define CMD_NOT_FOUND 127
+
+typedef struct process_t {
     pid_t pid;
-    char *argv[CMD_MAXARGS];
+    char **argv; /*NULL terminated, built by the parser*/
     char completed;
     char stopped;
     int status;
+    int jobid; /*job it belongs to, set when the job goes into the job table*/
+    struct process_t *pid_next; /*next in its bucket of the job table pid hash*/
 } process_t;
 
-/*creates a new process from a command string*/
-process_t *new_process (const char *cmd) ;
-
-void release_process (process_t *proc);
+/*creates a new process that runs argv (not copied), allocated in arena (freed with it)*/
+process_t *new_process (arena_t *arena, char **argv) ;
 
 /*
 this function alters the pid attribute in proc 
@@ -46,4 +49,14 @@ returns the pid of the child
  */
 pid_t run_process (process_t *proc, pid_t pgid, int input_redir, int output_redir, int error_redir);
 
+/*
+returns the absolute path of the command name, searched in PATH once and then 
+kept in the hash table (names with a '/' are returned as they are)
+returns NULL if it isn't found
+ */
+const char *hash_lookup (const char *name);
+
+/*empties the command hash table*/
+void hash_reset (void);
+
 #endif
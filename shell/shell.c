@@ -34,8 +34,8 @@
 
 #define IS_FG_JOB(job) (((job_t*)(job))==fgjob) 
 
-/*the head and tail of the jobs list*/
-qelem *job_list_head, *job_list_tail;
+/*every job that hasn't been released yet (see job.h)*/
+job_table_t job_table;
 
 /*
    job which is currently running as foreground
@@ -63,7 +63,7 @@ int shell_init (char is_interactive) {
     hexit = 0;
     fgjob = NULL;
     shell_cnt = 0;
-    job_list_head = job_list_tail = NULL;
+    sysfail (job_table_init (&job_table) < 0, -1);
 
     if (shell_intve) {
         signal (SIGINT, SIG_IGN);
@@ -91,28 +91,34 @@ int shell_nintve (const char *cmd) {
 }
 
 
+/*
+   reaps every child that changed, each one is found by its pid in the job table,
+   so only the job it belongs to is checked
+ */
 void _sigchld_handler (int signum) {
-    qelem *p, *q;
+    qelem *p;
     process_t *proc;
     job_t *job;
+    pid_t pid;
+    int status;
+    char completed_all, stopped_all;
+
+    while ((pid = waitpid (-1, &status, WNOHANG | WUNTRACED)) > 0) {
+        proc = job_table_find_pid (&job_table, pid);
+        if (proc == NULL)
+            continue;
+        proc->status = status;
+        if (WIFEXITED (status) || WIFSIGNALED (status)) {
+            proc->completed = 1;
+            job_table_forget_pid (&job_table, proc);
+        }
+        else if (WIFSTOPPED (status))
+            proc->stopped = 1;
 
-    for (q = job_list_head; q != NULL; q = (q != NULL) ? q->q_forw : job_list_head) {
-        
-        char completed_all = 1;
-        char stopped_all = 1;
-        job = (job_t*) q->q_data;
-
+        job = job_table_get (&job_table, proc->jobid);
+        completed_all = stopped_all = 1;
         for (p = job->process_list_head; p != NULL; p = p->q_forw) {
-
             proc = (process_t*) p->q_data;
-            if (proc->completed)
-                continue;
-            if (waitpid (proc->pid, &proc->status, WNOHANG | WUNTRACED)) {
-                if (WIFEXITED (proc->status) || WIFSIGNALED (proc->status)) 
-                    proc->completed = 1;
-                else if (WIFSTOPPED (proc->status)) 
-                    proc->stopped = 1;
-            }
             completed_all = completed_all && proc->completed;
             stopped_all = stopped_all && proc->stopped;
         }
@@ -122,18 +128,15 @@ void _sigchld_handler (int signum) {
          */
         if (completed_all) {
             job->completed = 1;
-            job->lch = ++shell_cnt;
+            job_table_touch (&job_table, job, ++shell_cnt);
             if (IS_FG_JOB (job)) {
                 fgjob = NULL;
-                LIST_REM (job_list_head, job_list_tail, q);
-                p = q->q_back;
-                release_job ((job_t*) q->q_data);
-                free (q);
-                q = p;
+                job_table_remove (&job_table, job);
+                release_job (job);
             }
         }
-        if (stopped_all) {
-            job->lch = ++shell_cnt;
+        else if (stopped_all) {
+            job_table_touch (&job_table, job, ++shell_cnt);
             if (IS_FG_JOB (job))
                 fgjob = NULL;
             job->stopped = 1;
@@ -142,23 +145,31 @@ void _sigchld_handler (int signum) {
 }
 
 int run_fgjob() {
-
+    sigset_t chld, oset, wset;
+
+    /*
+       SIGCHLD is blocked between the check and the sleep, otherwise the last child
+       may be reaped right before pause() and we'd wait forever; the children that
+       finished before _sigchld_handler was installed are collected here too
+     */
+    sigemptyset (&chld);
+    sigaddset (&chld, SIGCHLD);
+    sigprocmask (SIG_BLOCK, &chld, &oset);
+    /*fg runs inside create_job, which has SIGCHLD blocked too*/
+    wset = oset;
+    sigdelset (&wset, SIGCHLD);
+    if (fgjob != NULL && fgjob->completed == 0)
+        _sigchld_handler (SIGCHLD);
     while (fgjob != NULL && fgjob->completed == 0) {
-        pause();
+        sigsuspend (&wset);
     }
 
     if (fgjob != NULL) { /*this will only happen if the job has only builtin commands */
-        qelem *ptr;
-        for (ptr = job_list_head; ptr != NULL; ptr = ptr->q_forw) {
-            if (IS_FG_JOB ((job_t*) ptr->q_data)) {
-                LIST_REM (job_list_head, job_list_tail, ptr);
-                release_job (fgjob);
-                free (ptr);
-                fgjob = NULL;
-                break;
-            }
-        }
+        job_table_remove (&job_table, fgjob);
+        release_job (fgjob);
+        fgjob = NULL;
     }
+    sigprocmask (SIG_SETMASK, &oset, NULL);
 
     fgjob = NULL;
 
@@ -171,62 +182,30 @@ int run_fgjob() {
 }
 
 void print_job_list(int output_redir, int error_redir) {
-    qelem *ptr, *aux;
-    job_t *job;
-    size_t mch = 0;
-    int curr_jobid = 0;
-
-    for (ptr = job_list_head; ptr != NULL; ptr = ptr->q_forw) {
-        job = (job_t *)ptr->q_data;
-        if (job->lch > mch || (job->lch == mch && job->jobid > curr_jobid)) {
-            curr_jobid = job->jobid;
-            mch = job->lch;
-        }
-    }
+    job_t *job, *curr = job_table_curr (&job_table);
+    int jobid, top = job_table.top;
 
-    for (ptr = job_list_head; ptr != NULL; ptr = (ptr) ? ptr->q_forw: job_list_head) {
-        job = (job_t*) ptr->q_data;
+    for (jobid = 1; jobid <= top; ++jobid) {
+        job = job_table_get (&job_table, jobid);
+        if (job == NULL)
+            continue;
 
-        print_job (job, job->jobid == curr_jobid, output_redir);
+        print_job (job, job == curr, output_redir);
         write (output_redir, "\n", 1);
 
         if (job->completed) {
-            LIST_REM (job_list_head, job_list_tail, ptr);
-            aux = ptr->q_back;
-            free (ptr);
-            ptr = aux;
+            job_table_remove (&job_table, job);
             release_job (job);
         }
     }
 }
 
 job_t* get_job_id (int jobid) {
-    qelem *ptr;
-    job_t *job;
-
-    for (ptr = job_list_head; ptr != NULL; ptr = ptr->q_forw) {
-        job = (job_t*) ptr->q_data;
-        if (job->jobid == jobid)
-            return job;
-    }
-    return NULL;
+    return job_table_get (&job_table, jobid);
 }
 
 job_t* get_curr_job () {
-    size_t mch = 0; 
-    int jobid = 0;
-    qelem *ptr;
-    job_t *rjob = NULL, *job;
-
-    for (ptr = job_list_head; ptr != NULL; ptr = ptr->q_forw) {
-        job = (job_t*) ptr->q_data;
-        if (mch < job->lch || (mch == job->lch && jobid < job->jobid)) {
-            mch = job->lch;
-            jobid = job->jobid;
-            rjob = job;
-        }
-    }
-    return rjob;
+    return job_table_curr (&job_table);
 }
 
 int set_fgjob (job_t *job) {
@@ -252,7 +231,7 @@ int shell_job_bg (int jobid, int output_redir, int error_redir) {
         dprintf(error_redir, "fg: No such job\n");
         return 1;
     }
-    job->lch = ++shell_cnt;
+    job_table_touch (&job_table, job, ++shell_cnt);
     print_job_cmd (job, output_redir);
     write (output_redir, " &\n", 3);
     if (job->stopped) {
@@ -300,6 +279,7 @@ int create_job (const char *cmd) {
     /*io redirection stuff*/
     int io[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
     int iofl[3] = {O_RDONLY, O_WRONLY | O_CREAT, O_WRONLY | O_CREAT}; /*io flag for each one of the input redirection*/
+    int flags;
 
 
     process_t *proc = NULL;
@@ -307,16 +287,43 @@ int create_job (const char *cmd) {
     qelem *ptr;
     job_t *job = NULL;
     struct sigaction oact, act;
+    sigset_t chld, oset;
+
+    /*everything built from cmd lives in the arena, until the job is released*/
+    arena_t *arena = new_arena ();
+    sysfail (arena==NULL, -1);
 
-    cmd_line = new_cmd_line();
+    cmd_line = new_cmd_line (arena);
+    if (cmd_line == NULL) {
+        release_arena (arena);
+        return -1;
+    }
+
+    /*
+       no child can be reaped before its job is in the job table (its pid would
+       be unknown), SIGCHLD waits until create_job returns
+     */
+    sigemptyset (&chld);
+    sigaddset (&chld, SIGCHLD);
+    sigprocmask (SIG_BLOCK, &chld, &oset);
 
     aux = parse_cmd_line (cmd_line, cmd);
 
+    /*nothing is opened (and truncated by >) for a line that won't run*/
+    if (!IS_CMD_LINE_OK (aux)) {
+        ret = aux;
+        goto release_stuff;
+    }
+
     /*input redir file*/
     for (i=0; i<3; ++i) {
         if (cmd_line->io[i] != NULL) {
 
-            io[i] = open (cmd_line->io[i], iofl[i], S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+            /*> truncates and >> appends*/
+            flags = iofl[i];
+            if (i != STDIN_FILENO)
+                flags |= cmd_line->io_append[i] ? O_APPEND : O_TRUNC;
+            io[i] = open (cmd_line->io[i], flags, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
 
             if (io[i] < 0) {
                 printf ("%s: %s\n", cmd_line->io[i], strerror (errno));
@@ -325,52 +332,50 @@ int create_job (const char *cmd) {
         }
     }
 
-    job = new_job(io[STDIN_FILENO], io[STDOUT_FILENO], io[STDERR_FILENO]);
-
-    job->jobid = (job_list_tail == NULL) ? 1 : ((job_t*)job_list_tail->q_data)->jobid + 1;
-
-    if (!IS_CMD_LINE_OK (aux)) {
-        ret = aux;
+    job = new_job(arena, io[STDIN_FILENO], io[STDOUT_FILENO], io[STDERR_FILENO]);
+    if (job == NULL) {
+        ret = -1;
         goto release_stuff;
     }
 
     for (ptr = cmd_line->pipe_list_head; ptr != NULL; ptr=ptr->q_forw) {
-        proc = new_process (ptr->q_data);
-        aux = job_push_process (job, proc);
+        proc = new_process (arena, (char **) ptr->q_data);
+        aux = (proc != NULL) ? job_push_process (job, proc) : -1;
         if (aux==-1) {
             ret = -1;
             goto release_stuff;
         }
     }
 
+    act.sa_handler = _sigchld_handler;
+    sigemptyset (&act.sa_mask);
+    act.sa_flags = 0;
+
+    sigaction (SIGCHLD, NULL, &oact);
+
+    if (oact.sa_handler != _sigchld_handler)
+        sigaction (SIGCHLD, &act, NULL);
+
     /*running (need to know if it's foreground)*/
     aux = run_job (job);
 
-    /*problem with running the job*/
-    if (aux == -1) {
+    /*
+       problem with running the job, or no room to keep track of it: what was
+       started goes before the arena (its argv, pids...) is released
+     */
+    if (aux == -1 || job_table_add (&job_table, job) < 0) {
+        kill_job (job);
         ret = -1;
         goto release_stuff;
     }
     /*now we can consider the job is successfully begin executed*/
-    
+
     if (!cmd_line->is_nonblock) {
         fgjob = job;
         if (shell_intve)
             tcsetpgrp (shell_terminal, job->pgid);
     }
 
-    LIST_PUSH (job_list_head, job_list_tail, job);
-
-    act.sa_handler = _sigchld_handler;
-    sigemptyset (&act.sa_mask);
-    act.sa_flags = 0;
-
-    sigaction (SIGCHLD, NULL, &oact);
-
-    if (oact.sa_handler != _sigchld_handler)
-        sigaction (SIGCHLD, &act, NULL);
-        
-
     /*print_job (job); */
 
 
@@ -379,8 +384,15 @@ int create_job (const char *cmd) {
 
     /*TODO: find a better name for this*/
 release_stuff:
-    if (ret != 0)
+    /*the children have their own copies (and the builtins are done) by now*/
+    for (i = 0; i < 3; ++i)
+        if (io[i] >= 0 && io[i] != i)
+            close (io[i]);
+    /*a job that runs keeps the arena, the command line goes with it*/
+    if (job == NULL)
+        release_arena (arena);
+    else if (ret != 0)
         release_job (job);
-    release_cmd_line (cmd_line);
+    sigprocmask (SIG_SETMASK, &oset, NULL);
     return ret;
 }
@@ -0,0 +1,11 @@
+#parses every line of parser.in with parser-test and compares it with parser.out
+#usage: parser.sh [path of parser-test], 'make check' in shell/ runs it
+PARSER_TEST=${1:-../parser-test}
+DIR=$(dirname "$0")
+
+if "$PARSER_TEST" < "$DIR/parser.in" | diff -u "$DIR/parser.out" -; then
+    echo "parser: ok";
+else
+    echo "parser: FAILED";
+    exit 1;
+fi